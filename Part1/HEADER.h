@@ -13,16 +13,116 @@
 using namespace std;
 namespace fs = std::filesystem;
 
-const char DELIMITER = '#';
-const string TOMBSTONE = "tombstone";
 const int MAX_FILE_SIZE = 4096;
-const int INDEX_SIZE = 512;
-const int MAX_COMP_TIME = 100000;
-const int MIN_COMP_TIME = 1;
+const int BLOCK_ALIGNMENT = 4096;
+const int IO_QUEUE_DEPTH = 256;
+const int IO_BUFFER_POOL_SIZE = 256;
+const bool USE_DIRECT_IO = false;
+const string WAL_PATH = "wal.log";
+const bool WAL_SYNC = false;
+const string TABLE_DATA_FILE = "data.sst";
+const uint64_t TABLE_MAGIC = 0x44435342544c4253;
+const size_t TABLE_WRITE_BUFFER_SIZE = 1 << 20;
+const bool TABLE_DIRECT_WRITE = false;
+const bool TABLE_SYNC = true;
+const uint64_t TABLE_SYNC_INTERVAL = 1 << 20;
+const int INGEST_TABLE_KEYS = 10000;
+const int BUILD_RUN_KEYS = 1000000;
+const size_t BLOCK_CACHE_SIZE = 64 << 20;
+const size_t ROW_CACHE_SIZE = 16 << 20;
+const int ZSTD_LEVEL = 3;
+const string VLOG_DIR = "vlog";
+const size_t VLOG_THRESHOLD = 1024;
+const size_t VLOG_SEGMENT_SIZE = 64 << 20;
+const double VLOG_GC_RATIO = 0.5;
+const bool USE_FENCE_INDEX = true;
+const int FENCE_INDEX_ERROR = 4;
+const int FENCE_INDEX_MIN_BLOCKS = 64;
+const int FENCE_INDEX_MIN_FANOUT = 8;
+const int L0_COMPACTION_TRIGGER = 4;
+const size_t LEVEL_BASE_KEYS = 40000;
+const int LEVEL_SIZE_RATIO = 10;
+const int LEVEL_TABLE_KEYS = 10000;
+const size_t COMPACTION_RATE_LIMIT = 64 << 20;
+const size_t COMPACTION_RATE_MIN = 8 << 20;
+const int L0_SLOWDOWN_TABLES = 8;
+const int L0_STOP_TABLES = 12;
+const size_t COMPACTION_DEBT_SLOWDOWN_KEYS = 1000000;
+const size_t COMPACTION_DEBT_STOP_KEYS = 4000000;
+const int WRITE_SLOWDOWN_MAX_DELAY = 1000;
+const int TABLE_BUILD_THREADS = 4;
+const size_t TABLE_BUILD_QUEUE_BLOCKS = 32;
+const bool STATS_ENABLED = true;
+const int STATS_DUMP_INTERVAL = 60;
+const int STATS_SAMPLE_INTERVAL = 16;
 
 // Max AVL Tree size in memory 
 const int MAX_TREE_SIZE = 1000;
 
+enum RecordType : uint8_t
+{
+    RECORD_PUT = 0,
+    RECORD_DELETE = 1,
+    RECORD_MERGE = 2,    // Operand appended to the older value
+    RECORD_VALUE_REF = 3 // A put whose value is in the value log, the record holds the pointer
+};
+
+// Value log pointer: segment (4 bytes), value offset (8), value length (4)
+const size_t VLOG_POINTER_SIZE = 16;
+
+// One versioned write, as kept in the memtable and the SSTables
+struct Record
+{
+    string key;
+    string value;
+    uint64_t seq;
+    RecordType type;
+};
+
+// On disk: type (1 byte), seq (8), key length (4), value length (4), key, value
+const size_t RECORD_HEADER_SIZE = 17;
+
+enum BlockCodec : uint8_t
+{
+    CODEC_NONE = 0,
+    CODEC_LZ4 = 1,
+    CODEC_ZSTD = 2
+};
+
+// Block file: codec (1 byte), raw size (4), then the (compressed) records
+const size_t BLOCK_HEADER_SIZE = 5;
+const size_t BLOCK_CHECKSUM_SIZE = 4;
+const size_t TABLE_FOOTER_SIZE = 24;
+
+// A key is stored whole every this many records, the rest share a prefix with the previous key
+const int BLOCK_RESTART_INTERVAL = 16;
+
+// Block record header at most: type (1), seq (8), three varint32 lengths (5 each)
+const size_t BLOCK_RECORD_MAX_HEADER = 24;
+
+enum IOPriority : uint8_t
+{
+    IO_LOW = 0, // Compaction and value log collection, paced by the rate limiter
+    IO_HIGH = 1 // Flushes, never delayed
+};
+
+// Codec by table age: hot tables favour decode speed, the bottom favours size
+const BlockCodec FLUSH_CODEC = CODEC_LZ4;      // Flushed from the memtable
+const BlockCodec COMPACTION_CODEC = CODEC_LZ4; // Merged above the bottom
+const BlockCodec BOTTOM_CODEC = CODEC_ZSTD;    // Merged into the bottom, or built by sst_build
+
+// A record in place inside an encoded buffer. Keys in data blocks are prefix
+// compressed, BlockIter rebuilds them and leaves key_pos/key_len unset.
+struct RecordRef
+{
+    RecordType type;
+    uint64_t seq;
+    size_t key_pos;
+    size_t key_len;
+    size_t value_pos;
+    size_t value_len;
+};
+
 class Semaphore;
 class AVLTree;
 class SSTable;
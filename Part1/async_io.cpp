@@ -0,0 +1,255 @@
+#include <deque>
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+using namespace std;
+
+// Pool of preallocated aligned buffers, usable as O_DIRECT read targets
+class AlignedBufferPool
+{
+private:
+    vector<char *> free_list;
+    size_t buffer_size = 0;
+
+public:
+    void init(int count, size_t size)
+    {
+        buffer_size = size;
+        for (int i = 0; i < count; i++)
+        {
+            void *ptr = nullptr;
+            if (posix_memalign(&ptr, BLOCK_ALIGNMENT, size) == 0)
+            {
+                free_list.push_back(static_cast<char *>(ptr));
+            }
+        }
+    }
+
+    ~AlignedBufferPool()
+    {
+        for (char *ptr : free_list)
+        {
+            free(ptr);
+        }
+    }
+
+    size_t size() const
+    {
+        return buffer_size;
+    }
+
+    // Blocks larger than the pool size get a one-off aligned allocation
+    char *acquire(size_t size)
+    {
+        if (size > buffer_size)
+        {
+            void *ptr = nullptr;
+            return posix_memalign(&ptr, BLOCK_ALIGNMENT, size) == 0 ? static_cast<char *>(ptr) : nullptr;
+        }
+        if (free_list.empty())
+        {
+            return nullptr;
+        }
+        char *ptr = free_list.back();
+        free_list.pop_back();
+        return ptr;
+    }
+
+    void release(char *ptr, size_t size)
+    {
+        if (size > buffer_size)
+        {
+            free(ptr);
+            return;
+        }
+        free_list.push_back(ptr);
+    }
+};
+
+// A block read at an offset of a file, the callback gets the block's bytes read
+// or a negative errno. The buffer goes back to the pool once the callback and
+// every copy of the shared_ptr it was handed are gone. The file is the caller's,
+// it must stay open until the callback ran.
+struct AsyncRead
+{
+    int fd;
+    uint64_t offset;
+    size_t size;
+    size_t skip = 0; // Bytes read ahead of the block to align an O_DIRECT read
+    size_t buffer_size;
+    char *buffer = nullptr;
+    function<void(shared_ptr<const char>, int)> callback;
+};
+
+// Block reads submitted through io_uring, completions are reaped on the caller's event loop
+class AsyncReader
+{
+private:
+    struct uring ring;
+    AlignedBufferPool pool;
+    deque<AsyncRead *> waiting; // Reads waiting for a free buffer
+    deque<AsyncRead *> failed;  // Reads of no open file, completed on the next poll
+    int event_fd = -1;
+    bool direct_io = false;
+
+    size_t aligned_size(size_t size) const
+    {
+        return (size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+    }
+
+    void complete(AsyncRead *op, int res)
+    {
+        auto callback = std::move(op->callback);
+        shared_ptr<const char> buffer;
+        if (op->buffer != nullptr)
+        {
+            buffer = shared_ptr<const char>(op->buffer, [this, buffer_size = op->buffer_size](const char *ptr)
+                                            { release(const_cast<char *>(ptr), buffer_size); });
+            buffer = shared_ptr<const char>(buffer, op->buffer + op->skip);
+        }
+        if (res >= 0)
+        {
+            res = res < (int)op->skip ? -EIO : min<int>(res - op->skip, op->size);
+        }
+        delete op;
+
+        callback(std::move(buffer), res);
+    }
+
+    // Returns a buffer to the pool and starts a read that was waiting for one
+    void release(char *ptr, size_t size)
+    {
+        pool.release(ptr, size);
+        if (!waiting.empty())
+        {
+            start_waiting();
+            uring_submit_and_wait(&ring, 0);
+        }
+    }
+
+    void start(AsyncRead *op)
+    {
+        if (op->fd < 0)
+        {
+            // Never run callbacks from inside read(), report it from poll() instead
+            failed.push_back(op);
+            eventfd_write(event_fd, 1);
+            return;
+        }
+
+        struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+        if (sqe == nullptr)
+        {
+            uring_submit_and_wait(&ring, 0);
+            sqe = uring_get_sqe(&ring);
+        }
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = op->fd;
+        sqe->addr = reinterpret_cast<unsigned long>(op->buffer);
+        sqe->len = direct_io ? aligned_size(op->skip + op->size) : op->size;
+        sqe->off = op->offset - op->skip;
+        sqe->user_data = reinterpret_cast<unsigned long>(op);
+    }
+
+    void start_waiting()
+    {
+        while (!waiting.empty())
+        {
+            AsyncRead *op = waiting.front();
+            op->buffer = pool.acquire(op->buffer_size);
+            if (op->buffer == nullptr)
+            {
+                return;
+            }
+            waiting.pop_front();
+            start(op);
+        }
+    }
+
+public:
+    // Returns the eventfd signalled on completions, or -1 when io_uring is unavailable
+    int init(bool use_direct_io)
+    {
+        direct_io = use_direct_io;
+        if (uring_init(&ring, IO_QUEUE_DEPTH, 0) < 0)
+        {
+            return -1;
+        }
+
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0 || syscall(__NR_io_uring_register, ring.ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0)
+        {
+            uring_exit(&ring);
+            if (event_fd >= 0)
+            {
+                close(event_fd);
+            }
+            event_fd = -1;
+            return -1;
+        }
+
+        // An unaligned block of at most MAX_FILE_SIZE bytes spans one alignment unit more
+        pool.init(IO_BUFFER_POOL_SIZE, aligned_size(MAX_FILE_SIZE) + BLOCK_ALIGNMENT);
+        return event_fd;
+    }
+
+    int fd() const
+    {
+        return event_fd;
+    }
+
+    // Reads size bytes at offset of fd. With direct I/O the read is aligned, fd may be opened with O_DIRECT then.
+    void read(int fd, uint64_t offset, size_t size, function<void(shared_ptr<const char>, int)> callback)
+    {
+        AsyncRead *op = new AsyncRead;
+        op->fd = fd;
+        op->offset = offset;
+        op->size = size;
+        op->skip = direct_io ? offset % BLOCK_ALIGNMENT : 0;
+        op->buffer_size = max(aligned_size(op->skip + size), pool.size());
+        op->callback = std::move(callback);
+
+        op->buffer = waiting.empty() ? pool.acquire(op->buffer_size) : nullptr;
+        if (op->buffer == nullptr)
+        {
+            waiting.push_back(op);
+            return;
+        }
+        start(op);
+        uring_submit_and_wait(&ring, 0);
+    }
+
+    // Reap finished reads and run their callbacks, which may queue further reads
+    void poll()
+    {
+        uint64_t count;
+        while (::read(event_fd, &count, sizeof(count)) > 0)
+        {
+        }
+
+        while (!failed.empty())
+        {
+            AsyncRead *op = failed.front();
+            failed.pop_front();
+            complete(op, -EBADF);
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&ring)) != nullptr)
+        {
+            AsyncRead *op = reinterpret_cast<AsyncRead *>(cqe->user_data);
+            int res = cqe->res;
+            uring_cqe_seen(&ring);
+            complete(op, res);
+        }
+        uring_submit_and_wait(&ring, 0);
+    }
+};
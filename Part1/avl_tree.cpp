@@ -12,11 +12,11 @@ struct AVLTreeNode
     AVLTreeNode *right;
 
     string key;
-    string value;
+    shared_ptr<const Record> record; // Shared so readers can pin it past an overwrite
     int count;
     int height;
 
-    AVLTreeNode(const string &key, const string &value);
+    AVLTreeNode(const Record &record);
     void updateValues();
     int balanceFactor();
 
@@ -24,8 +24,8 @@ struct AVLTreeNode
     AVLTreeNode *right_rotate();
 };
 
-AVLTreeNode::AVLTreeNode(const string &key, const string &value)
-    : key(key), value(value), left(nullptr), right(nullptr), count(1), height(1) {}
+AVLTreeNode::AVLTreeNode(const Record &record)
+    : left(nullptr), right(nullptr), key(record.key), record(make_shared<const Record>(record)), count(1), height(1) {}
 
 void AVLTreeNode::updateValues()
 {
@@ -70,15 +70,16 @@ public:
     AVLTree();
     ~AVLTree();
 
-    void insert(const string &key, const string &value);
+    void insert(const Record &record);
     void erase(const string &key);
     void clear();
     bool empty() const;
     int size() const;
-    vector<pair<string, string>> getSortedPairs() const;
+    vector<Record> getSortedRecords() const;
+    vector<shared_ptr<const Record>> getSortedShared() const;
 
-    pair<bool, string> find(const string &key) const;
-    string operator[](int idx) const;
+    shared_ptr<const Record> find(const string &key) const;
+    Record operator[](int idx) const;
 };
 
 AVLTree::AVLTree() : root(nullptr), _size(0) {}
@@ -115,8 +116,10 @@ int AVLTree::size() const
     return _size;
 }
 
-void AVLTree::insert(const string &key, const string &value)
+// Adds the record, replacing the one already stored for its key
+void AVLTree::insert(const Record &record)
 {   
+    const string &key = record.key;
     AVLTreeNode **indirect = &root;
     vector<AVLTreeNode **> path;
 
@@ -126,7 +129,7 @@ void AVLTree::insert(const string &key, const string &value)
 
         if ((*indirect)->key == key)
         {
-            (*indirect)->value = value;
+            (*indirect)->record = make_shared<const Record>(record);
             return;
         }
         else if ((*indirect)->key > key)
@@ -135,7 +138,7 @@ void AVLTree::insert(const string &key, const string &value)
             indirect = &((*indirect)->right);
     }
 
-    *indirect = new AVLTreeNode(key, value);
+    *indirect = new AVLTreeNode(record);
     path.push_back(indirect);
 
     balance(path);
@@ -195,23 +198,24 @@ void AVLTree::erase(const string &key)
     _size--;
 }
 
-pair<bool, string> AVLTree::find(const string &key) const
+// The stored record itself, nullptr if the key is not found
+shared_ptr<const Record> AVLTree::find(const string &key) const
 {
     AVLTreeNode *direct = root;
 
     while (direct != nullptr)
     {
         if (direct->key == key)
-            return make_pair(true, direct->value);
+            return direct->record;
         else if (direct->key > key)
             direct = direct->left;
         else
             direct = direct->right;
     }
-    return make_pair(false, "tombstone"); // Key not found
+    return nullptr;
 }
 
-string AVLTree::operator[](int idx) const
+Record AVLTree::operator[](int idx) const
 {
     AVLTreeNode *cur = root;
     int left = cur->left ? cur->left->count : 0;
@@ -231,7 +235,7 @@ string AVLTree::operator[](int idx) const
         }
     }
 
-    return cur->value;
+    return *cur->record;
 }
 
 void AVLTree::balance(vector<AVLTreeNode **> &path)
@@ -261,19 +265,34 @@ void AVLTree::balance(vector<AVLTreeNode **> &path)
     }
 }
 
-vector<pair<string, string>> AVLTree::getSortedPairs() const
+vector<Record> AVLTree::getSortedRecords() const
 {
-    vector<pair<string, string>> result;
+    vector<Record> result;
     function<void(AVLTreeNode *)> inOrderTraversal = [&](AVLTreeNode *node)
     {
         if (node == nullptr)
             return;
         inOrderTraversal(node->left);
-        result.emplace_back(node->key, node->value);
+        result.push_back(*node->record);
         inOrderTraversal(node->right);
     };
     inOrderTraversal(root);
     return result;
 }
 
-
+// The records themselves in key order, a cheap copy that later inserts do not change
+vector<shared_ptr<const Record>> AVLTree::getSortedShared() const
+{
+    vector<shared_ptr<const Record>> result;
+    result.reserve(_size);
+    function<void(AVLTreeNode *)> inOrderTraversal = [&](AVLTreeNode *node)
+    {
+        if (node == nullptr)
+            return;
+        inOrderTraversal(node->left);
+        result.push_back(node->record);
+        inOrderTraversal(node->right);
+    };
+    inOrderTraversal(root);
+    return result;
+}
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Runs redis-benchmark against the select, epoll and uring backends on this machine.
+# Without redis-benchmark, YCSB workload a (50% GET, 50% SET) from ./bench_ycsb
+# is run instead, one connection per client, after `make bench`.
+# Usage: ./bench_backends.sh [requests] [clients] [keyspace]
+
+REQUESTS=${1:-100000}
+CLIENTS=${2:-100}
+KEYSPACE=${3:-100}
+PORT=6390
+
+mkdir -p results
+
+for backend in select epoll uring; do
+    rm -rf SSTable_* vlog wal.log
+    ./server $PORT $backend > /dev/null &
+    pid=$!
+    sleep 1
+
+    if command -v redis-benchmark > /dev/null; then
+        redis-benchmark -p $PORT -t set,get -n $REQUESTS -c $CLIENTS -r $KEYSPACE > results/result_${REQUESTS}_${CLIENTS}_${backend}.txt
+        grep -A 0 "requests per second" results/result_${REQUESTS}_${CLIENTS}_${backend}.txt | sed "s/^/$backend: /"
+    else
+        ./bench_ycsb --workload a --server 127.0.0.1:$PORT --threads $CLIENTS --records $KEYSPACE \
+            --operations $REQUESTS > results/result_${REQUESTS}_${CLIENTS}_${backend}.json
+        grep -E '"run"|"READ"|"UPDATE"' results/result_${REQUESTS}_${CLIENTS}_${backend}.json | sed "s/^ */$backend: /"
+    fi
+
+    kill $pid
+    wait $pid 2> /dev/null
+done
+
+rm -rf SSTable_* vlog wal.log
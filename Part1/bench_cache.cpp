@@ -0,0 +1,104 @@
+// Row cache hit rate and GET latency under a Zipfian key popularity. Loads the
+// keys into tables in a scratch directory, then runs the same GET sequence
+// with the row cache off and at several sizes.
+// Usage: ./bench_cache [keys] [gets] [theta]
+#include "lsm.cpp"
+#include "workload.cpp"
+
+static double now_sec()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t num_keys = argc > 1 ? strtoull(argv[1], NULL, 10) : 200000;
+    size_t num_gets = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+    double theta = argc > 3 ? atof(argv[3]) : 0.99;
+
+    char dir[] = "/tmp/bench_cache.XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0 || start_value_log() < 0)
+    {
+        perror("scratch directory");
+        return 1;
+    }
+    start_compaction();
+
+    // Keys are written in random order so every table spans the key range
+    mt19937_64 rng(42);
+    vector<uint64_t> order(num_keys);
+    for (uint64_t i = 0; i < num_keys; i++)
+    {
+        order[i] = i;
+    }
+    shuffle(order.begin(), order.end(), rng);
+    string value(100, 'v');
+    for (uint64_t i : order)
+    {
+        string key = workload_key(i);
+        SET(key.data(), key.size(), value.data(), value.size());
+    }
+    // Compaction settles before anything is measured
+    while (compaction_pending())
+    {
+        usleep(100000);
+    }
+
+    // Popular ranks are scattered over the key space, and a tenth of the GETs miss
+    ZipfianGenerator zipf(num_keys, theta);
+    vector<string> keys(num_gets);
+    for (string &key : keys)
+    {
+        uint64_t rank = zipf.next(rng);
+        uint64_t id = scramble(rank, num_keys);
+        key = rng() % 10 == 0 ? workload_key(num_keys + id) : workload_key(id);
+    }
+
+    printf("%llu keys, %zu GETs, theta %.2f\n", (unsigned long long)num_keys, num_gets, theta);
+    printf("%-12s %10s %10s %10s %10s\n", "row cache", "hit rate", "mean ns", "p50 ns", "p99 ns");
+    for (size_t size : {(size_t)0, (size_t)1 << 20, (size_t)4 << 20, (size_t)16 << 20})
+    {
+        row_cache.set_capacity(size);
+        vector<uint32_t> latency(num_gets);
+        size_t found = 0;
+        double total = 0;
+        // A first pass warms the caches, the second is measured
+        for (int pass = 0; pass < 2; pass++)
+        {
+            uint64_t hits = row_cache.get_hits(), misses = row_cache.get_misses();
+            double start = now_sec();
+            for (size_t i = 0; i < num_gets; i++)
+            {
+                struct kv_value result;
+                auto op_start = chrono::steady_clock::now();
+                if (GET(keys[i].data(), keys[i].size(), &result) == KV_FOUND)
+                {
+                    found++;
+                    RELEASE_VALUE(&result);
+                }
+                latency[i] = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - op_start).count();
+            }
+            total = now_sec() - start;
+            hits = row_cache.get_hits() - hits;
+            misses = row_cache.get_misses() - misses;
+            if (pass == 1)
+            {
+                sort(latency.begin(), latency.end());
+                char label[16];
+                snprintf(label, sizeof(label), size == 0 ? "off" : "%zu MB", size >> 20);
+                printf("%-12s %9.1f%% %10.0f %10u %10u\n", label, hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+                       total / num_gets * 1e9, latency[num_gets / 2], latency[num_gets * 99 / 100]);
+            }
+        }
+        if (found == 0)
+        {
+            fprintf(stderr, "no key found\n");
+            return 1;
+        }
+    }
+
+    error_code ec;
+    fs::remove_all(dir, ec);
+    fflush(stdout);
+    _exit(0); // The compaction thread never returns
+}
@@ -0,0 +1,107 @@
+#include "HEADER.h"
+#include "compression.cpp"
+#include "block.cpp"
+#include <cstring>
+#include <chrono>
+#include <random>
+
+// Compression ratio and CPU cost of each block codec, over data blocks
+// built like SSTable blocks (key:%012d keys, records filled up to a 4KB file)
+// Usage: ./bench_codec [value_size] [keys] [rounds] [random]
+// random = 1 fills values with random bytes instead of text
+
+static double now_sec()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t value_size = argc > 1 ? strtoul(argv[1], NULL, 10) : 100;
+    long keys = argc > 2 ? atol(argv[2]) : 200000;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    bool random_values = argc > 4 && atoi(argv[4]) != 0;
+
+    const char *words[] = {"user", "session", "cart", "item", "price", "id", "status", "active", "name", "email", "2024", "true", "false", "null"};
+    mt19937_64 rng(42);
+    vector<string> blocks;
+    BlockBuilder builder;
+    for (long i = 0; i < keys; i++)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "key:%012ld", i);
+        string value;
+        while (value.size() < value_size)
+        {
+            if (random_values)
+                value += (char)rng();
+            else
+                value += string(words[rng() % 14]) + (rng() % 2 ? ":" : " ") + to_string(rng() % 1000) + " ";
+        }
+        value.resize(value_size);
+
+        Record record = {key, value, (uint64_t)i + 1, RECORD_PUT};
+        if (!builder.empty() && builder.size_with(record) > MAX_FILE_SIZE - BLOCK_HEADER_SIZE)
+        {
+            blocks.push_back(builder.finish());
+        }
+        builder.add(record);
+    }
+    blocks.push_back(builder.finish());
+
+    size_t raw_bytes = 0;
+    for (const string &b : blocks)
+    {
+        raw_bytes += b.size();
+    }
+    size_t record_bytes = keys * (RECORD_HEADER_SIZE + 16 + value_size);
+    printf("%zu blocks, %.1f MB raw (%.2fx smaller than whole keys and fixed headers), %zu byte values%s\n", blocks.size(),
+           raw_bytes / 1e6, (double)record_bytes / raw_bytes, value_size, random_values ? " (random)" : "");
+    printf("%-6s %8s %14s %16s %14s\n", "codec", "ratio", "encode MB/s", "decode MB/s", "decode us/blk");
+
+    const pair<BlockCodec, const char *> codecs[] = {{CODEC_NONE, "none"}, {CODEC_LZ4, "lz4"}, {CODEC_ZSTD, "zstd"}};
+    for (const auto &codec : codecs)
+    {
+        if (!compression_libs.available(codec.first))
+        {
+            printf("%-6s unavailable\n", codec.second);
+            continue;
+        }
+
+        vector<string> encoded(blocks.size());
+        double start = now_sec();
+        for (int r = 0; r < rounds; r++)
+        {
+            for (size_t i = 0; i < blocks.size(); i++)
+            {
+                encoded[i] = encodeBlock(blocks[i], codec.first);
+            }
+        }
+        double encode_time = now_sec() - start;
+
+        size_t disk_bytes = 0, checksum = 0;
+        for (const string &e : encoded)
+        {
+            disk_bytes += e.size();
+        }
+        start = now_sec();
+        for (int r = 0; r < rounds; r++)
+        {
+            for (const string &e : encoded)
+            {
+                checksum += decodeBlock(e.data(), e.size())->size();
+            }
+        }
+        double decode_time = now_sec() - start;
+        if (checksum != raw_bytes * rounds)
+        {
+            fprintf(stderr, "%s: decoded size mismatch\n", codec.second);
+            return 1;
+        }
+
+        printf("%-6s %8.2f %14.1f %16.1f %14.2f\n", codec.second, (double)raw_bytes / disk_bytes,
+               raw_bytes * rounds / encode_time / 1e6, raw_bytes * rounds / decode_time / 1e6,
+               decode_time / rounds / blocks.size() * 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,386 @@
+// Micro-benchmarks of the engine's hot paths in isolation: memtable insert and
+// find, Bloom filter probes, SSTable::find and mergeSortedSSTables, across key
+// and value sizes. Each benchmark is timed in several samples and reports the
+// median and fastest ns/op, the spread of the samples and heap allocations per op.
+//
+// Saving the --json output and passing it back with --baseline compares a
+// build against it: the tool exits 1 if a benchmark's fastest sample got
+// slower than the tolerance allows, or it allocates more per op. Other load
+// on the machine only ever adds time, so the fastest sample is the stable one.
+// Usage: ./bench_engine [--filter text] [--json] [--baseline file] [--tolerance pct]
+#include "lsm.cpp"
+#include "workload.cpp"
+
+// Every allocation of the process is counted, benchmarks read the difference.
+// malloc is interposed rather than operator new, so new and delete stay paired:
+// libstdc++'s operator new allocates through it.
+atomic<uint64_t> allocations{0};
+
+extern "C" void *__libc_malloc(size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+    allocations.fetch_add(1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+const int SAMPLES = 9;
+const double SAMPLE_SECONDS = 0.1;
+
+// Time and allocations of the measured part of a benchmark body
+class Timer
+{
+private:
+    chrono::steady_clock::time_point started;
+    double elapsed = 0;
+    uint64_t allocs = 0, allocs_started = 0;
+
+public:
+    void resume()
+    {
+        allocs_started = allocations.load(memory_order_relaxed);
+        started = chrono::steady_clock::now();
+    }
+
+    void pause()
+    {
+        elapsed += chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        allocs += allocations.load(memory_order_relaxed) - allocs_started;
+    }
+
+    double seconds() const
+    {
+        return elapsed;
+    }
+
+    uint64_t allocated() const
+    {
+        return allocs;
+    }
+};
+
+struct Result
+{
+    string name;
+    double ns_per_op; // Median sample
+    double best_ns_per_op;
+    double spread; // Width of the middle half of the samples, relative to the median
+    double allocs_per_op;
+};
+
+// Runs body, which does ops operations per call and may pause the timer around
+// its setup, until a sample lasts SAMPLE_SECONDS, then takes SAMPLES samples
+template <class Body>
+Result run(const string &name, size_t ops, Body body)
+{
+    size_t calls = 1;
+    while (true)
+    {
+        Timer timer;
+        for (size_t i = 0; i < calls; i++)
+        {
+            body(timer);
+        }
+        if (timer.seconds() >= SAMPLE_SECONDS / 4 || calls >= (1 << 24))
+        {
+            calls = max<size_t>(1, calls * SAMPLE_SECONDS / max(timer.seconds(), 1e-9));
+            break;
+        }
+        calls *= 4;
+    }
+
+    vector<double> samples;
+    uint64_t allocs = 0;
+    for (int s = 0; s < SAMPLES; s++)
+    {
+        Timer timer;
+        for (size_t i = 0; i < calls; i++)
+        {
+            body(timer);
+        }
+        samples.push_back(timer.seconds() * 1e9 / (calls * ops));
+        allocs += timer.allocated();
+    }
+    sort(samples.begin(), samples.end());
+    double median = samples[SAMPLES / 2];
+    return {name, median, samples[0], (samples[SAMPLES * 3 / 4] - samples[SAMPLES / 4]) / median, (double)allocs / ((double)SAMPLES * calls * ops)};
+}
+
+// Keys of key_size bytes, at least 16, in random order, and random printable values
+string bench_key(uint64_t id, size_t key_size)
+{
+    string key = workload_key(scramble(id, 1000000000000ULL));
+    key.resize(max(key_size, key.size()), 'k');
+    return key;
+}
+
+vector<Record> bench_records(size_t n, size_t key_size, size_t value_size, uint64_t first_id, uint64_t step)
+{
+    mt19937_64 rng(n + key_size + value_size);
+    vector<Record> records(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        records[i].key = bench_key(first_id + i * step, key_size);
+        records[i].value.resize(value_size);
+        for (char &c : records[i].value)
+        {
+            c = 'a' + rng() % 26;
+        }
+        records[i].seq = i + 1;
+        records[i].type = RECORD_PUT;
+    }
+    return records;
+}
+
+void sort_records(vector<Record> &records)
+{
+    sort(records.begin(), records.end(), [](const Record &a, const Record &b)
+         { return a.key < b.key; });
+}
+
+string size_label(size_t key_size, size_t value_size)
+{
+    return "/k" + to_string(key_size) + "/v" + to_string(value_size);
+}
+
+vector<Result> run_all(const string &filter)
+{
+    vector<Result> results;
+    auto want = [&](const string &name)
+    { return filter.empty() || name.find(filter) != string::npos; };
+    const size_t sizes[][2] = {{16, 16}, {16, 100}, {64, 100}, {16, 512}};
+
+    for (const auto &size : sizes)
+    {
+        size_t key_size = size[0], value_size = size[1];
+        string label = size_label(key_size, value_size);
+        const size_t N = 10000;
+
+        // Memtable: inserts into a tree of up to N keys, finds in a full one
+        vector<Record> records = bench_records(N, key_size, value_size, 0, 2);
+        if (want("avl_insert" + label))
+        {
+            results.push_back(run("avl_insert" + label, N, [&](Timer &timer)
+                                  {
+                AVLTree memtable;
+                timer.resume();
+                for (const Record &record : records)
+                    memtable.insert(record);
+                timer.pause(); }));
+        }
+        if (want("avl_find" + label))
+        {
+            AVLTree memtable;
+            for (const Record &record : records)
+                memtable.insert(record);
+            vector<string> keys;
+            for (size_t i = 0; i < N; i++)
+                keys.push_back(records[(i * 7919) % N].key);
+            results.push_back(run("avl_find" + label, N, [&](Timer &timer)
+                                  {
+                size_t found = 0;
+                timer.resume();
+                for (const string &key : keys)
+                    found += memtable.find(key) != nullptr;
+                timer.pause();
+                if (found != N)
+                    abort(); }));
+        }
+
+        // Table reads with the blocks in the block cache: present keys and absent
+        // ones inside the table's range (odd ids), which the filter mostly rejects
+        sort_records(records);
+        shared_ptr<SSTable> table;
+        if (want("sstable_find" + label))
+        {
+            // A new folder each time, the block cache never expects one to be reused
+            table = make_shared<SSTable>(pair<int, Record *>{N, records.data()});
+            vector<string> present, absent;
+            for (size_t i = 0; i < N; i++)
+            {
+                present.push_back(records[(i * 7919) % N].key);
+                absent.push_back(bench_key((i * 7919) % N * 2 + 1, key_size));
+            }
+            for (const auto &[suffix, keys, expected] : {tuple{"/hit", &present, N}, tuple{"/miss", &absent, (size_t)0}})
+            {
+                results.push_back(run("sstable_find" + label + suffix, N, [&, keys = keys, expected = expected](Timer &timer)
+                                      {
+                    size_t found = 0;
+                    timer.resume();
+                    for (const string &key : *keys)
+                    {
+                        RecordRef ref;
+                        shared_ptr<const char> value;
+                        found += table->find(key, ref, value);
+                    }
+                    timer.pause();
+                    if (found != expected)
+                        abort(); }));
+            }
+            table.reset();
+        }
+
+        // Merge of two tables' records, half the keys in both: ns per input record
+        if (want("merge" + label))
+        {
+            vector<Record> recent = bench_records(N, key_size, value_size, 0, 1);
+            vector<Record> old = bench_records(N, key_size, value_size, N / 2, 1);
+            sort_records(recent);
+            sort_records(old);
+            for (Record &record : recent)
+                record.seq += N;
+            results.push_back(run("merge" + label, 2 * N, [&](Timer &timer)
+                                  {
+                vector<Record> garbage;
+                timer.resume();
+                pair<int, Record *> merged = mergeSortedSSTables({N, recent.data()}, {N, old.data()}, false, garbage);
+                timer.pause();
+                delete[] merged.second; }));
+        }
+    }
+
+    // Bloom filter probes at its design size, keys are the filter's own or never added
+    if (want("filter_exists"))
+    {
+        const int N = 10000;
+        ProbabilisticSet filter;
+        vector<string> present, absent;
+        for (int i = 0; i < N; i++)
+        {
+            present.push_back(bench_key(2 * i, 16));
+            absent.push_back(bench_key(2 * i + 1, 16));
+            filter.insert(present.back());
+        }
+        for (const auto &[name, keys] : {pair{"filter_exists/hit", &present}, pair{"filter_exists/miss", &absent}})
+        {
+            size_t positives = 0, probes = 0;
+            Result result = run(name, N, [&, keys = keys](Timer &timer)
+                                {
+                timer.resume();
+                for (const string &key : *keys)
+                    positives += filter.exists(key);
+                timer.pause();
+                probes += N; });
+            if (keys == &absent)
+            {
+                cerr << "filter false positive rate " << 100.0 * positives / probes << "%" << endl;
+            }
+            results.push_back(result);
+        }
+    }
+    return results;
+}
+
+// Reads results written by --json: one benchmark per line
+map<string, Result> read_baseline(const string &path)
+{
+    map<string, Result> baseline;
+    ifstream in(path);
+    string line;
+    while (getline(in, line))
+    {
+        char name[128];
+        Result result;
+        if (sscanf(line.c_str(), " {\"name\": \"%127[^\"]\", \"ns_per_op\": %lf, \"best_ns_per_op\": %lf, \"spread\": %lf, \"allocs_per_op\": %lf",
+                   name, &result.ns_per_op, &result.best_ns_per_op, &result.spread, &result.allocs_per_op) == 5)
+        {
+            result.name = name;
+            baseline[name] = result;
+        }
+    }
+    return baseline;
+}
+
+int main(int argc, char *argv[])
+{
+    string filter, baseline_path;
+    bool json = false;
+    double tolerance = 10;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--json")
+            json = true;
+        else if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (arg == "--tolerance" && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [--filter text] [--json] [--baseline file] [--tolerance pct]" << endl;
+            return 1;
+        }
+    }
+    map<string, Result> baseline;
+    if (!baseline_path.empty())
+    {
+        baseline = read_baseline(baseline_path);
+        if (baseline.empty())
+        {
+            cerr << "No results in " << baseline_path << endl;
+            return 1;
+        }
+    }
+
+    // Tables are written to a scratch directory
+    char dir[] = "/tmp/bench_engine.XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0)
+    {
+        perror("scratch directory");
+        return 1;
+    }
+    vector<Result> results = run_all(filter);
+    error_code ec;
+    fs::remove_all(dir, ec);
+
+    int regressions = 0;
+    if (json)
+    {
+        printf("[\n");
+    }
+    else
+    {
+        printf("%-28s %10s %10s %8s %10s %s\n", "benchmark", "ns/op", "best ns/op", "spread", "allocs/op",
+               baseline.empty() ? "" : "  best vs baseline");
+    }
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result &r = results[i];
+        string verdict;
+        auto base = baseline.find(r.name);
+        if (base != baseline.end())
+        {
+            double change = (r.best_ns_per_op / base->second.best_ns_per_op - 1) * 100;
+            char text[64];
+            snprintf(text, sizeof(text), "%+.1f%%", change);
+            verdict = text;
+            if (change > tolerance || r.allocs_per_op > base->second.allocs_per_op + 0.01)
+            {
+                verdict += " REGRESSION";
+                regressions++;
+            }
+        }
+        if (json)
+        {
+            printf("  {\"name\": \"%s\", \"ns_per_op\": %.2f, \"best_ns_per_op\": %.2f, \"spread\": %.3f, \"allocs_per_op\": %.3f}%s\n",
+                   r.name.c_str(), r.ns_per_op, r.best_ns_per_op, r.spread, r.allocs_per_op, i + 1 == results.size() ? "" : ",");
+        }
+        else
+        {
+            printf("%-28s %10.1f %10.1f %7.1f%% %10.2f   %s\n", r.name.c_str(), r.ns_per_op, r.best_ns_per_op, r.spread * 100,
+                   r.allocs_per_op, verdict.c_str());
+        }
+    }
+    if (json)
+    {
+        printf("]\n");
+    }
+    if (regressions > 0)
+    {
+        fprintf(stderr, "%d benchmarks regressed by more than %.1f%%\n", regressions, tolerance);
+    }
+    fflush(stdout);
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+#include "HEADER.h"
+#include "fence_index.cpp"
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+// Block lookups with the learned fence index against a binary search over the
+// fence keys, as SSTable::locate_block does them
+// Usage: ./bench_index [blocks] [lookups]
+
+static double now_sec()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Fence keys of a table with the given number of blocks, in key order
+static vector<string> make_fences(const string &kind, size_t blocks, mt19937_64 &rng)
+{
+    vector<string> keys;
+    char key[64];
+    for (size_t i = 0; keys.size() < blocks; i++)
+    {
+        if (kind == "sequential")
+        {
+            // Blocks of about 35 key:%012d keys, as the server's tables hold
+            snprintf(key, sizeof(key), "key:%012zu", i * 35);
+        }
+        else if (kind == "uniform")
+        {
+            snprintf(key, sizeof(key), "key:%012llu", (unsigned long long)(rng() % 1000000000000ULL));
+        }
+        else if (kind == "skewed")
+        {
+            // Dense clusters of ids far apart
+            snprintf(key, sizeof(key), "user:%08llu:%06llu", (unsigned long long)(rng() % 64 * 1000003),
+                     (unsigned long long)(rng() % 1000000));
+        }
+        else
+        {
+            // Words, no numeric structure
+            string word;
+            for (int c = 0; c < 12; c++)
+                word += (char)('a' + rng() % 26);
+            snprintf(key, sizeof(key), "%s", word.c_str());
+        }
+        keys.push_back(key);
+    }
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t num_blocks = argc > 1 ? strtoul(argv[1], NULL, 10) : 4096;
+    size_t lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000000;
+
+    printf("%zu blocks, error bound %d, %zu lookups\n", num_blocks, FENCE_INDEX_ERROR, lookups);
+    printf("%-11s %9s %12s %12s %12s %12s %12s\n", "keys", "segments", "binary keys", "model ints", "model keys", "binary ns",
+           "learned ns");
+
+    for (const string kind : {"sequential", "uniform", "skewed", "words"})
+    {
+        mt19937_64 rng(42);
+        vector<string> fences = make_fences(kind, num_blocks, rng);
+        FenceIndex index;
+        index.build(fences);
+
+        // Lookup keys inside the table's range: fence keys with a random suffix
+        vector<string> keys(lookups);
+        for (string &key : keys)
+        {
+            key = fences[rng() % fences.size()];
+            key.back() = '0' + rng() % 10;
+        }
+
+        size_t binary_probes = 0, checksum = 0;
+        double start = now_sec();
+        for (const string &key : keys)
+        {
+            auto it = upper_bound(fences.begin(), fences.end(), key);
+            checksum += it - fences.begin();
+        }
+        double binary_time = now_sec() - start;
+        for (size_t i = 0; i < 10000 && i < keys.size(); i++)
+        {
+            upper_bound(fences.begin(), fences.end(), keys[i], [&](const string &a, const string &b)
+                        { binary_probes++; return a < b; });
+        }
+
+        if (index.empty())
+        {
+            printf("%-11s %9s %12.2f %12s %12s %12.1f %12s\n", kind.c_str(), "-", binary_probes / 10000.0, "no index", "-",
+                   binary_time / lookups * 1e9, "-");
+            continue;
+        }
+
+        size_t learned_checksum = 0;
+        start = now_sec();
+        for (const string &key : keys)
+        {
+            size_t lo = 0, hi = fences.size();
+            index.bound(key, lo, hi);
+            learned_checksum += upper_bound(fences.begin() + lo, fences.begin() + hi, key) - fences.begin();
+        }
+        double learned_time = now_sec() - start;
+        if (learned_checksum != checksum)
+        {
+            fprintf(stderr, "%s: learned index found other blocks\n", kind.c_str());
+            return 1;
+        }
+
+        // Model probes compare integers, key probes compare fence keys
+        size_t model_probes = 0, key_probes = 0;
+        for (size_t i = 0; i < 10000 && i < keys.size(); i++)
+        {
+            int probes = 0;
+            size_t lo = 0, hi = fences.size();
+            index.bound(keys[i], lo, hi, &probes);
+            model_probes += probes;
+            key_probes++; // The shared prefix
+            upper_bound(fences.begin() + lo, fences.begin() + hi, keys[i], [&](const string &a, const string &b)
+                        { key_probes++; return a < b; });
+        }
+
+        printf("%-11s %9zu %12.2f %12.2f %12.2f %12.1f %12.1f\n", kind.c_str(), index.num_segments(), binary_probes / 10000.0,
+               model_probes / 10000.0, key_probes / 10000.0, binary_time / lookups * 1e9, learned_time / lookups * 1e9);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "resp.h"
+
+// Parse throughput of the RESP request parser over a buffer of pipelined SETs
+// Usage: ./bench_resp [value_size] [commands] [rounds] [chunk]
+// chunk > 0 feeds the buffer in pieces of that size to exercise resumable parsing
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t value_size = argc > 1 ? strtoul(argv[1], NULL, 10) : 32;
+    long commands = argc > 2 ? atol(argv[2]) : 100000;
+    int rounds = argc > 3 ? atoi(argv[3]) : 20;
+    size_t chunk = argc > 4 ? strtoul(argv[4], NULL, 10) : 0;
+
+    char *value = (char *)malloc(value_size + 1);
+    memset(value, 'v', value_size);
+    value[value_size] = '\0';
+
+    size_t cap = commands * (value_size + 64);
+    char *buf = (char *)malloc(cap);
+    size_t len = 0;
+    for (long i = 0; i < commands; i++)
+    {
+        char key[32];
+        int key_len = snprintf(key, sizeof(key), "key:%012ld", i);
+        len += sprintf(buf + len, "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%zu\r\n%s\r\n", key_len, key, value_size, value);
+    }
+
+    struct resp_parser parser;
+    resp_parser_init(&parser);
+
+    size_t checksum = 0;
+    double start = now_sec();
+    for (int r = 0; r < rounds; r++)
+    {
+        size_t off = 0, avail = chunk ? 0 : len;
+        while (off < len)
+        {
+            if (chunk && avail < len)
+            {
+                avail = avail + chunk < len ? avail + chunk : len;
+            }
+
+            size_t consumed;
+            int ret = resp_parse(&parser, buf + off, avail - off, &consumed);
+            if (ret == RESP_INCOMPLETE)
+            {
+                continue;
+            }
+            if (ret == RESP_ERROR)
+            {
+                fprintf(stderr, "Parse error at offset %zu\n", off);
+                return 1;
+            }
+            checksum += parser.argv[2].len;
+            off += consumed;
+        }
+    }
+    double elapsed = now_sec() - start;
+
+    double total_cmds = (double)commands * rounds;
+    printf("value_size=%zu commands=%ld rounds=%d chunk=%zu\n", value_size, commands, rounds, chunk);
+    printf("%.2f M commands/s, %.1f MB/s, %.1f ns/command (checksum %zu)\n",
+           total_cmds / elapsed / 1e6, (double)len * rounds / elapsed / 1e6, elapsed * 1e9 / total_cmds, checksum);
+
+    resp_parser_free(&parser);
+    free(buf);
+    free(value);
+    return 0;
+}
@@ -0,0 +1,529 @@
+// YCSB core workloads against the engine API or a running server over RESP.
+// Loads --records keys, then runs --operations operations of the workload's mix
+// on --threads threads and prints throughput and per-operation latency
+// percentiles as JSON. The engine is driven in a scratch directory; its calls
+// are serialized like the server's event loop serializes them.
+//
+// Workloads (YCSB core): a 50% read 50% update, b 95% read 5% update,
+// c 100% read, d 95% read 5% insert, e 95% scan 5% insert, f 50% read 50%
+// read-modify-write. Key distributions: uniform, zipfian (scrambled), latest.
+//
+// Usage: ./bench_ycsb [--workload a-f] [--distribution uniform|zipfian|latest]
+//        [--records N] [--operations N] [--threads N] [--value-size N]
+//        [--theta X] [--server host:port] [--skip-load]
+#include "lsm.cpp"
+#include "workload.cpp"
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+enum Operation
+{
+    OP_READ,
+    OP_UPDATE,
+    OP_INSERT,
+    OP_SCAN,
+    OP_READ_MODIFY_WRITE,
+    OP_COUNT
+};
+const char *OP_NAMES[OP_COUNT] = {"READ", "UPDATE", "INSERT", "SCAN", "READ-MODIFY-WRITE"};
+
+struct Workload
+{
+    char name;
+    double mix[OP_COUNT]; // Share of each operation
+    const char *distribution;
+};
+
+const Workload WORKLOADS[] = {
+    {'a', {0.5, 0.5, 0, 0, 0}, "zipfian"},
+    {'b', {0.95, 0.05, 0, 0, 0}, "zipfian"},
+    {'c', {1, 0, 0, 0, 0}, "zipfian"},
+    {'d', {0.95, 0, 0.05, 0, 0}, "latest"},
+    {'e', {0, 0, 0.05, 0.95, 0}, "zipfian"},
+    {'f', {0.5, 0, 0, 0, 0.5}, "zipfian"},
+};
+
+const int MAX_SCAN_LENGTH = 100; // Scan lengths are uniform in 1..MAX_SCAN_LENGTH, as in YCSB
+
+// Where operations go, one per thread
+class Target
+{
+public:
+    virtual ~Target() {}
+    virtual bool read(const string &key) = 0;
+    virtual bool write(const string &key, const string &value) = 0;
+    virtual bool scan(const string &start, int count) = 0;
+};
+
+mutex mtx_engine;
+
+class EngineTarget : public Target
+{
+public:
+    bool read(const string &key) override
+    {
+        lock_guard<mutex> lock(mtx_engine);
+        struct kv_value value;
+        int found = GET(key.data(), key.size(), &value);
+        if (found == KV_FOUND)
+        {
+            RELEASE_VALUE(&value);
+        }
+        return found != KV_ERROR;
+    }
+
+    bool write(const string &key, const string &value) override
+    {
+        lock_guard<mutex> lock(mtx_engine);
+        return SET(key.data(), key.size(), value.data(), value.size()) != KV_ERROR;
+    }
+
+    bool scan(const string &start, int count) override
+    {
+        lock_guard<mutex> lock(mtx_engine);
+        struct kv_snapshot *snapshot = SNAPSHOT();
+        struct kv_iterator *it = SCAN(snapshot, start.data(), start.size());
+        const char *key;
+        size_t key_len;
+        struct kv_value value;
+        int found = KV_FOUND;
+        for (int i = 0; i < count && (found = SCAN_NEXT(it, &key, &key_len, &value)) == KV_FOUND; i++)
+        {
+            RELEASE_VALUE(&value);
+        }
+        SCAN_CLOSE(it);
+        RELEASE_SNAPSHOT(snapshot);
+        return found != KV_ERROR;
+    }
+};
+
+// One connection, one request in flight
+class RespTarget : public Target
+{
+private:
+    int fd = -1;
+    string in;
+    string out;
+
+    void append_arg(const string &arg)
+    {
+        out += "$" + to_string(arg.size()) + "\r\n";
+        out += arg;
+        out += "\r\n";
+    }
+
+    // Sends the command in out and reads one reply, false on an error reply or a lost connection
+    bool call()
+    {
+        for (size_t sent = 0; sent < out.size();)
+        {
+            ssize_t n = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+            {
+                return false;
+            }
+            sent += n;
+        }
+        out.clear();
+        while (true)
+        {
+            size_t end = in.find("\r\n");
+            if (end != string::npos)
+            {
+                char type = in[0];
+                size_t length = end + 2;
+                if (type == '$' && in[1] != '-')
+                {
+                    length += strtoull(in.c_str() + 1, NULL, 10) + 2;
+                }
+                if (in.size() >= length)
+                {
+                    in.erase(0, length);
+                    return type != '-';
+                }
+            }
+            char buf[65536];
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0)
+            {
+                return false;
+            }
+            in.append(buf, n);
+        }
+    }
+
+public:
+    bool connect_to(const string &host, const string &port)
+    {
+        struct addrinfo hints = {}, *addrs;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0)
+        {
+            return false;
+        }
+        for (struct addrinfo *addr = addrs; addr != NULL && fd < 0; addr = addr->ai_next)
+        {
+            fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+            if (fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addrs);
+        int one = 1;
+        return fd >= 0 && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == 0;
+    }
+
+    ~RespTarget()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    bool read(const string &key) override
+    {
+        out = "*2\r\n";
+        append_arg("GET");
+        append_arg(key);
+        return call();
+    }
+
+    bool write(const string &key, const string &value) override
+    {
+        out = "*3\r\n";
+        append_arg("SET");
+        append_arg(key);
+        append_arg(value);
+        return call();
+    }
+
+    bool scan(const string &, int) override
+    {
+        return false; // The server's SCAN has no start key, workload e is rejected up front
+    }
+};
+
+struct Options
+{
+    const Workload *workload = &WORKLOADS[0];
+    string distribution;
+    uint64_t records = 100000;
+    uint64_t operations = 1000000;
+    int threads = 1;
+    size_t value_size = 100;
+    double theta = 0.99;
+    string server; // host:port, empty for the engine
+    bool load = true;
+};
+
+// Chooses the keys of one thread's operations
+class KeyChooser
+{
+private:
+    const Options &options;
+    ZipfianGenerator zipf;
+    atomic<uint64_t> &inserted;
+
+public:
+    KeyChooser(const Options &options, atomic<uint64_t> &inserted)
+        : options(options), zipf(options.records, options.theta), inserted(inserted) {}
+
+    // A record that exists, or is being inserted
+    uint64_t existing(mt19937_64 &rng)
+    {
+        uint64_t count = inserted;
+        if (options.distribution == "uniform")
+        {
+            return rng() % count;
+        }
+        if (options.distribution == "latest")
+        {
+            return count - 1 - min(count - 1, zipf.next(rng));
+        }
+        return scramble(zipf.next(rng), options.records);
+    }
+};
+
+static double now_sec()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage(const char *name)
+{
+    cerr << "Usage: " << name << " [--workload a-f] [--distribution uniform|zipfian|latest] [--records N]"
+         << " [--operations N] [--threads N] [--value-size N] [--theta X] [--server host:port] [--skip-load]" << endl;
+}
+
+static bool parse_options(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string name = argv[i];
+        if (name == "--skip-load")
+        {
+            options.load = false;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        string value = argv[++i];
+        if (name == "--workload")
+        {
+            options.workload = NULL;
+            for (const Workload &workload : WORKLOADS)
+            {
+                if (value.size() == 1 && tolower(value[0]) == workload.name)
+                {
+                    options.workload = &workload;
+                }
+            }
+            if (options.workload == NULL)
+            {
+                return false;
+            }
+        }
+        else if (name == "--distribution" && (value == "uniform" || value == "zipfian" || value == "latest"))
+            options.distribution = value;
+        else if (name == "--records")
+            options.records = strtoull(value.c_str(), NULL, 10);
+        else if (name == "--operations")
+            options.operations = strtoull(value.c_str(), NULL, 10);
+        else if (name == "--threads")
+            options.threads = atoi(value.c_str());
+        else if (name == "--value-size")
+            options.value_size = strtoul(value.c_str(), NULL, 10);
+        else if (name == "--theta")
+            options.theta = atof(value.c_str());
+        else if (name == "--server" && value.find(':') != string::npos)
+            options.server = value;
+        else
+            return false;
+    }
+    if (options.distribution.empty())
+    {
+        options.distribution = options.workload->distribution;
+    }
+    return options.records > 1 && options.threads > 0 && options.theta > 0 && options.theta < 1;
+}
+
+static Target *make_target(const Options &options)
+{
+    if (options.server.empty())
+    {
+        return new EngineTarget();
+    }
+    RespTarget *target = new RespTarget();
+    size_t colon = options.server.rfind(':');
+    if (!target->connect_to(options.server.substr(0, colon), options.server.substr(colon + 1)))
+    {
+        delete target;
+        return NULL;
+    }
+    return target;
+}
+
+// Random printable bytes, so the codecs see data that does not collapse
+static string random_value(size_t size, mt19937_64 &rng)
+{
+    string value(size, '\0');
+    for (char &c : value)
+    {
+        c = 'a' + rng() % 26;
+    }
+    return value;
+}
+
+static void print_histogram(const char *name, const LatencyHistogram &histogram, uint64_t errors, bool last)
+{
+    printf("    \"%s\": {\"count\": %llu, \"errors\": %llu, \"mean\": %.2f, \"p50\": %.2f, \"p99\": %.2f, "
+           "\"p99.9\": %.2f, \"p99.99\": %.2f, \"max\": %.2f}%s\n",
+           name, (unsigned long long)histogram.count(), (unsigned long long)errors, histogram.mean() / 1000,
+           histogram.percentile(50) / 1000.0, histogram.percentile(99) / 1000.0, histogram.percentile(99.9) / 1000.0,
+           histogram.percentile(99.99) / 1000.0, histogram.maximum() / 1000.0, last ? "" : ",");
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!options.server.empty() && options.workload->mix[OP_SCAN] > 0)
+    {
+        cerr << "Workload e needs scans from a start key, which the server's SCAN does not take" << endl;
+        return 1;
+    }
+
+    char dir[] = "/tmp/bench_ycsb.XXXXXX";
+    if (options.server.empty())
+    {
+        if (mkdtemp(dir) == NULL || chdir(dir) != 0 || start_value_log() < 0)
+        {
+            perror("scratch directory");
+            return 1;
+        }
+        start_compaction();
+    }
+
+    vector<unique_ptr<Target>> targets;
+    for (int i = 0; i < options.threads; i++)
+    {
+        targets.emplace_back(make_target(options));
+        if (targets.back() == nullptr)
+        {
+            cerr << "Cannot connect to " << options.server << endl;
+            return 1;
+        }
+    }
+
+    // Load: every thread inserts its share of the records
+    atomic<uint64_t> next_load{0};
+    atomic<uint64_t> load_errors{0};
+    double load_seconds = 0;
+    if (options.load)
+    {
+        double start = now_sec();
+        vector<thread> threads;
+        for (int t = 0; t < options.threads; t++)
+        {
+            threads.emplace_back([&, t]()
+                                 {
+                mt19937_64 rng(1000 + t);
+                string value = random_value(options.value_size, rng);
+                for (uint64_t id = next_load++; id < options.records; id = next_load++)
+                {
+                    if (!targets[t]->write(workload_key(id), value))
+                        load_errors++;
+                } });
+        }
+        for (thread &t : threads)
+        {
+            t.join();
+        }
+        load_seconds = now_sec() - start;
+        while (options.server.empty() && compaction_pending())
+        {
+            usleep(100000);
+        }
+    }
+
+    // Run
+    atomic<uint64_t> inserted{options.records};
+    vector<unique_ptr<LatencyHistogram[]>> histograms;
+    vector<array<uint64_t, OP_COUNT>> errors(options.threads);
+    for (int t = 0; t < options.threads; t++)
+    {
+        histograms.emplace_back(new LatencyHistogram[OP_COUNT]);
+        errors[t].fill(0);
+    }
+    double start = now_sec();
+    vector<thread> threads;
+    for (int t = 0; t < options.threads; t++)
+    {
+        threads.emplace_back([&, t]()
+                             {
+            mt19937_64 rng(t + 1);
+            KeyChooser chooser(options, inserted);
+            string value = random_value(options.value_size, rng);
+            uint64_t count = options.operations / options.threads + ((uint64_t)t < options.operations % options.threads);
+            for (uint64_t i = 0; i < count; i++)
+            {
+                double pick = uniform_real_distribution<double>(0, 1)(rng);
+                int op = 0;
+                while (op < OP_COUNT - 1 && pick >= options.workload->mix[op])
+                {
+                    pick -= options.workload->mix[op];
+                    op++;
+                }
+                value[i % value.size()] = 'a' + rng() % 26; // Updates write a different value
+
+                auto op_start = chrono::steady_clock::now();
+                bool ok = true;
+                switch (op)
+                {
+                case OP_READ:
+                    ok = targets[t]->read(workload_key(chooser.existing(rng)));
+                    break;
+                case OP_UPDATE:
+                    ok = targets[t]->write(workload_key(chooser.existing(rng)), value);
+                    break;
+                case OP_INSERT:
+                    ok = targets[t]->write(workload_key(inserted++), value);
+                    break;
+                case OP_SCAN:
+                    ok = targets[t]->scan(workload_key(chooser.existing(rng)), 1 + rng() % MAX_SCAN_LENGTH);
+                    break;
+                case OP_READ_MODIFY_WRITE:
+                {
+                    string key = workload_key(chooser.existing(rng));
+                    ok = targets[t]->read(key) && targets[t]->write(key, value);
+                    break;
+                }
+                }
+                histograms[t][op].record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - op_start).count());
+                if (!ok)
+                    errors[t][op]++;
+            } });
+    }
+    for (thread &t : threads)
+    {
+        t.join();
+    }
+    double run_seconds = now_sec() - start;
+
+    // Results, latencies in microseconds
+    printf("{\n");
+    printf("  \"workload\": \"%c\",\n", options.workload->name);
+    printf("  \"target\": \"%s\",\n", options.server.empty() ? "engine" : options.server.c_str());
+    printf("  \"distribution\": \"%s\",\n", options.distribution.c_str());
+    printf("  \"theta\": %.2f,\n", options.theta);
+    printf("  \"records\": %llu,\n", (unsigned long long)options.records);
+    printf("  \"operations\": %llu,\n", (unsigned long long)options.operations);
+    printf("  \"threads\": %d,\n", options.threads);
+    printf("  \"value_size\": %zu,\n", options.value_size);
+    if (options.load)
+    {
+        printf("  \"load\": {\"seconds\": %.3f, \"throughput\": %.1f, \"errors\": %llu},\n", load_seconds,
+               options.records / load_seconds, (unsigned long long)load_errors.load());
+    }
+    printf("  \"run\": {\"seconds\": %.3f, \"throughput\": %.1f},\n", run_seconds, options.operations / run_seconds);
+    printf("  \"latency_us\": {\n");
+    vector<int> used;
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        if (options.workload->mix[op] > 0)
+        {
+            used.push_back(op);
+        }
+    }
+    for (size_t i = 0; i < used.size(); i++)
+    {
+        LatencyHistogram total;
+        uint64_t op_errors = 0;
+        for (int t = 0; t < options.threads; t++)
+        {
+            total.merge(histograms[t][used[i]]);
+            op_errors += errors[t][used[i]];
+        }
+        print_histogram(OP_NAMES[used[i]], total, op_errors, i + 1 == used.size());
+    }
+    printf("  }\n}\n");
+
+    if (options.server.empty())
+    {
+        error_code ec;
+        fs::remove_all(dir, ec);
+    }
+    fflush(stdout);
+    _exit(0); // The compaction thread never returns
+}
@@ -0,0 +1,201 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+using namespace std;
+
+// Data block layout: the records, then the restart offsets (4 bytes each) and
+// their count (4). A record is type (1), seq (8), then varints for the key bytes
+// shared with the previous key, the unshared key bytes and the value length,
+// then the unshared key bytes and the value. Every BLOCK_RESTART_INTERVAL
+// records a key is stored whole, at a restart point.
+
+void putVarint32(string &dst, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        dst += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    dst += static_cast<char>(value);
+}
+
+// Returns the position after the varint at pos, 0 if it runs past end
+size_t getVarint32(const char *data, size_t pos, size_t end, uint32_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift <= 28 && pos < end; shift += 7)
+    {
+        uint8_t byte = data[pos++];
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return pos;
+        }
+    }
+    return 0;
+}
+
+class BlockBuilder
+{
+private:
+    string buffer;
+    vector<uint32_t> restarts;
+    int counter = 0; // Records since the last restart
+    string last_key;
+
+public:
+    bool empty() const
+    {
+        return buffer.empty();
+    }
+
+    // Upper bound of the finished block's size if record were added
+    size_t size_with(const Record &record) const
+    {
+        return buffer.size() + BLOCK_RECORD_MAX_HEADER + record.key.size() + record.value.size() +
+               (restarts.size() + 2) * sizeof(uint32_t);
+    }
+
+    // Appends a record, keys must come in order. Returns its offset in the block.
+    size_t add(const Record &record)
+    {
+        size_t shared = 0;
+        if (buffer.empty() || counter == BLOCK_RESTART_INTERVAL)
+        {
+            restarts.push_back(buffer.size());
+            counter = 0;
+        }
+        else
+        {
+            size_t limit = min(last_key.size(), record.key.size());
+            while (shared < limit && last_key[shared] == record.key[shared])
+            {
+                shared++;
+            }
+        }
+
+        size_t offset = buffer.size();
+        buffer += static_cast<char>(record.type);
+        buffer.append(reinterpret_cast<const char *>(&record.seq), sizeof(uint64_t));
+        putVarint32(buffer, shared);
+        putVarint32(buffer, record.key.size() - shared);
+        putVarint32(buffer, record.value.size());
+        buffer.append(record.key, shared, string::npos);
+        buffer += record.value;
+
+        last_key = record.key;
+        counter++;
+        return offset;
+    }
+
+    // Returns the block and starts an empty one
+    string finish()
+    {
+        for (uint32_t restart : restarts)
+        {
+            buffer.append(reinterpret_cast<const char *>(&restart), sizeof(uint32_t));
+        }
+        uint32_t num_restarts = restarts.size();
+        buffer.append(reinterpret_cast<const char *>(&num_restarts), sizeof(uint32_t));
+
+        string block = std::move(buffer);
+        buffer.clear();
+        restarts.clear();
+        counter = 0;
+        last_key.clear();
+        return block;
+    }
+};
+
+// Walks the records of a decoded block in key order, rebuilding each key from
+// its shared prefix. ref holds the current record's type, seq and value.
+struct BlockIter
+{
+    const char *data = nullptr;
+    size_t end = 0; // Where the records end and the restart offsets begin
+    uint32_t num_restarts = 0;
+    size_t pos = 0; // Offset of the next record
+    string key;
+    RecordRef ref;
+
+    // False if the block is too short for its restart offsets
+    bool init(const char *block, size_t size)
+    {
+        data = block;
+        pos = 0;
+        key.clear();
+        if (size < sizeof(uint32_t))
+        {
+            return false;
+        }
+        memcpy(&num_restarts, block + size - sizeof(uint32_t), sizeof(uint32_t));
+        if (num_restarts > size / sizeof(uint32_t) - 1)
+        {
+            return false;
+        }
+        end = size - (num_restarts + 1) * sizeof(uint32_t);
+        return true;
+    }
+
+    uint32_t restart(uint32_t idx) const
+    {
+        uint32_t offset;
+        memcpy(&offset, data + end + idx * sizeof(uint32_t), sizeof(uint32_t));
+        return offset;
+    }
+
+    // Decodes the record at pos and moves past it, false at the end of the block
+    bool next()
+    {
+        uint32_t shared, unshared, value_len;
+        size_t p = pos + 1 + sizeof(uint64_t);
+        if (p > end || !(p = getVarint32(data, p, end, shared)) || !(p = getVarint32(data, p, end, unshared)) ||
+            !(p = getVarint32(data, p, end, value_len)) || shared > key.size() || unshared > end - p ||
+            value_len > end - p - unshared)
+        {
+            return false;
+        }
+        ref.type = static_cast<RecordType>(data[pos]);
+        memcpy(&ref.seq, data + pos + 1, sizeof(uint64_t));
+        key.resize(shared);
+        key.append(data + p, unshared);
+        ref.value_pos = p + unshared;
+        ref.value_len = value_len;
+        pos = ref.value_pos + value_len;
+        return true;
+    }
+
+    // Positions on the first record with a key not below target, false if there is none.
+    // Binary searches the restart points, then scans at most one restart interval.
+    bool seek(const string &target)
+    {
+        uint32_t lo = 0, hi = num_restarts;
+        while (hi - lo > 1)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            pos = restart(mid);
+            key.clear();
+            if (!next())
+            {
+                return false;
+            }
+            if (key < target)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        pos = num_restarts > 0 ? restart(lo) : end;
+        key.clear();
+        while (next())
+        {
+            if (key >= target)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
@@ -0,0 +1,54 @@
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// LRU cache of decoded (decompressed) data blocks keyed by block path. Table
+// folders are never reused, so an entry can never go stale, blocks of deleted
+// tables just age out. Handed out blocks stay valid after eviction.
+class BlockCache
+{
+private:
+    typedef pair<string, shared_ptr<const string>> Entry;
+    list<Entry> lru; // Most recently used first
+    unordered_map<string, list<Entry>::iterator> index;
+    size_t capacity;
+    size_t usage = 0;
+    mutex mtx;
+
+public:
+    BlockCache(size_t capacity_bytes) : capacity(capacity_bytes) {}
+
+    shared_ptr<const string> lookup(const string &path)
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = index.find(path);
+        if (it == index.end())
+        {
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->second;
+    }
+
+    void insert(const string &path, shared_ptr<const string> block)
+    {
+        lock_guard<mutex> lock(mtx);
+        if (capacity == 0 || index.count(path))
+        {
+            return;
+        }
+        usage += block->size();
+        lru.emplace_front(path, std::move(block));
+        index[path] = lru.begin();
+        while (usage > capacity && !lru.empty())
+        {
+            usage -= lru.back().second->size();
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+    }
+};
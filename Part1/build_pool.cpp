@@ -0,0 +1,116 @@
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+using namespace std;
+
+// Worker threads shared by every table being built. A table's producer encodes
+// records into blocks and hands each one to the pool to compress and write,
+// while another job fills the table's filter.
+class BuildPool
+{
+private:
+    deque<function<void()>> jobs;
+    mutex mtx;
+    condition_variable cv;
+
+    void work()
+    {
+        while (true)
+        {
+            function<void()> job;
+            {
+                unique_lock<mutex> lock(mtx);
+                cv.wait(lock, [this]
+                        { return !jobs.empty(); });
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+public:
+    BuildPool(int threads)
+    {
+        for (int i = 0; i < threads; i++)
+        {
+            thread(&BuildPool::work, this).detach();
+        }
+    }
+
+    void submit(function<void()> job)
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            jobs.push_back(std::move(job));
+        }
+        cv.notify_one();
+    }
+};
+
+// The jobs of one table build. At most max_pending are queued or running, so
+// a producer faster than the workers waits instead of holding every block in
+// memory. Without a pool the jobs run inline.
+class BuildPipeline
+{
+private:
+    BuildPool *pool;
+    size_t max_pending;
+    size_t pending = 0;
+    mutex mtx;
+    condition_variable cv;
+
+public:
+    BuildPipeline(BuildPool *pool, size_t max_pending) : pool(pool), max_pending(max_pending) {}
+
+    // Jobs reference the table being built, none may outlive the pipeline
+    ~BuildPipeline()
+    {
+        wait();
+    }
+
+    void run(function<void()> job)
+    {
+        if (pool == nullptr)
+        {
+            job();
+            return;
+        }
+        {
+            unique_lock<mutex> lock(mtx);
+            cv.wait(lock, [this]
+                    { return pending < max_pending; });
+            pending++;
+        }
+        pool->submit([this, job = std::move(job)]
+                     {
+            job();
+            lock_guard<mutex> lock(mtx);
+            pending--;
+            cv.notify_all(); });
+    }
+
+    // Returns once every job run so far has finished
+    void wait()
+    {
+        unique_lock<mutex> lock(mtx);
+        cv.wait(lock, [this]
+                { return pending == 0; });
+    }
+};
+
+// One worker fewer than the cores, leaving one for the producer; none on a
+// single core. The pool is never destroyed, its workers wait for jobs until exit.
+BuildPool *build_pool()
+{
+    static BuildPool *pool = []() -> BuildPool *
+    {
+        int threads = min<int>(TABLE_BUILD_THREADS, (int)thread::hardware_concurrency() - 1);
+        return threads > 0 ? new BuildPool(threads) : nullptr;
+    }();
+    return pool;
+}
@@ -0,0 +1,146 @@
+#include <string>
+#include <memory>
+#include <cstring>
+#include <iostream>
+#include <dlfcn.h>
+
+using namespace std;
+
+// LZ4 and Zstd are loaded at runtime, a missing library leaves its blocks uncompressed
+class CompressionLibs
+{
+private:
+    int (*lz4_compress)(const char *, char *, int, int) = nullptr;
+    int (*lz4_decompress)(const char *, char *, int, int) = nullptr;
+    int (*lz4_bound)(int) = nullptr;
+    // Contexts are reused per thread, setting one up costs more than a 4KB block
+    void *(*zstd_create_cctx)() = nullptr;
+    void *(*zstd_create_dctx)() = nullptr;
+    size_t (*zstd_compress)(void *, void *, size_t, const void *, size_t, int) = nullptr;
+    size_t (*zstd_decompress)(void *, void *, size_t, const void *, size_t) = nullptr;
+    size_t (*zstd_bound)(size_t) = nullptr;
+    unsigned (*zstd_is_error)(size_t) = nullptr;
+
+    template <typename F>
+    static void load(void *lib, const char *name, F &fn)
+    {
+        fn = lib != nullptr ? reinterpret_cast<F>(dlsym(lib, name)) : nullptr;
+    }
+
+public:
+    CompressionLibs()
+    {
+        void *lz4 = dlopen("liblz4.so.1", RTLD_NOW);
+        load(lz4, "LZ4_compress_default", lz4_compress);
+        load(lz4, "LZ4_decompress_safe", lz4_decompress);
+        load(lz4, "LZ4_compressBound", lz4_bound);
+
+        void *zstd = dlopen("libzstd.so.1", RTLD_NOW);
+        load(zstd, "ZSTD_createCCtx", zstd_create_cctx);
+        load(zstd, "ZSTD_createDCtx", zstd_create_dctx);
+        load(zstd, "ZSTD_compressCCtx", zstd_compress);
+        load(zstd, "ZSTD_decompressDCtx", zstd_decompress);
+        load(zstd, "ZSTD_compressBound", zstd_bound);
+        load(zstd, "ZSTD_isError", zstd_is_error);
+    }
+
+    bool available(BlockCodec codec) const
+    {
+        switch (codec)
+        {
+        case CODEC_LZ4:
+            return lz4_compress && lz4_decompress && lz4_bound;
+        case CODEC_ZSTD:
+            return zstd_create_cctx && zstd_create_dctx && zstd_compress && zstd_decompress && zstd_bound && zstd_is_error;
+        default:
+            return codec == CODEC_NONE;
+        }
+    }
+
+    // Appends the compressed form of raw to out, false if the codec cannot make it
+    bool compress(BlockCodec codec, const string &raw, string &out) const
+    {
+        if (!available(codec) || codec == CODEC_NONE)
+        {
+            return false;
+        }
+        size_t start = out.size();
+        if (codec == CODEC_LZ4)
+        {
+            out.resize(start + lz4_bound(raw.size()));
+            int n = lz4_compress(raw.data(), &out[start], raw.size(), out.size() - start);
+            out.resize(start + max(n, 0));
+            return n > 0;
+        }
+        static thread_local void *cctx = zstd_create_cctx();
+        out.resize(start + zstd_bound(raw.size()));
+        size_t n = zstd_compress(cctx, &out[start], out.size() - start, raw.data(), raw.size(), ZSTD_LEVEL);
+        if (zstd_is_error(n))
+        {
+            out.resize(start);
+            return false;
+        }
+        out.resize(start + n);
+        return true;
+    }
+
+    // Decompresses exactly raw_size bytes into out
+    bool decompress(BlockCodec codec, const char *data, size_t size, char *out, size_t raw_size) const
+    {
+        if (!available(codec))
+        {
+            return false;
+        }
+        if (codec == CODEC_NONE)
+        {
+            if (size != raw_size)
+                return false;
+            memcpy(out, data, size);
+            return true;
+        }
+        if (codec == CODEC_LZ4)
+        {
+            return lz4_decompress(data, out, size, raw_size) == (int)raw_size;
+        }
+        static thread_local void *dctx = zstd_create_dctx();
+        size_t n = zstd_decompress(dctx, out, raw_size, data, size);
+        return !zstd_is_error(n) && n == raw_size;
+    }
+};
+
+CompressionLibs compression_libs;
+
+// Block file: codec (1 byte), raw size (4), then the records, compressed unless
+// the codec is CODEC_NONE. A block that does not shrink is stored raw.
+string encodeBlock(const string &raw, BlockCodec codec)
+{
+    string out(BLOCK_HEADER_SIZE, '\0');
+    uint32_t raw_size = raw.size();
+    memcpy(&out[1], &raw_size, sizeof(raw_size));
+    if (compression_libs.compress(codec, raw, out) && out.size() < BLOCK_HEADER_SIZE + raw.size())
+    {
+        out[0] = codec;
+        return out;
+    }
+    out.resize(BLOCK_HEADER_SIZE);
+    out[0] = CODEC_NONE;
+    out += raw;
+    return out;
+}
+
+// The records of a block file, nullptr if it is damaged or its codec is unavailable
+shared_ptr<const string> decodeBlock(const char *data, size_t size)
+{
+    if (size < BLOCK_HEADER_SIZE)
+    {
+        return nullptr;
+    }
+    uint32_t raw_size;
+    memcpy(&raw_size, data + 1, sizeof(raw_size));
+    auto raw = make_shared<string>(raw_size, '\0');
+    if (!compression_libs.decompress((BlockCodec)data[0], data + BLOCK_HEADER_SIZE, size - BLOCK_HEADER_SIZE, &(*raw)[0], raw_size))
+    {
+        return nullptr;
+    }
+    return raw;
+}
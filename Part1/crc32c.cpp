@@ -0,0 +1,68 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+using namespace std;
+
+// CRC32C (Castagnoli polynomial, reflected) checksums data blocks and table
+// metadata. The SSE4.2 crc32 instruction takes 8 bytes per step, other CPUs
+// use a byte-wise table.
+
+static uint32_t crc32c_software(const char *data, size_t len, uint32_t crc)
+{
+    static const auto table = []
+    {
+        array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(const char *data, size_t len, uint32_t crc)
+{
+    uint64_t crc64 = crc;
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = crc64;
+    for (; len > 0; data++, len--)
+    {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(const char *data, size_t len, uint32_t crc = 0)
+{
+    crc = ~crc;
+#if defined(__x86_64__)
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    if (sse42)
+    {
+        return ~crc32c_sse42(data, len, crc);
+    }
+#endif
+    return ~crc32c_software(data, len, crc);
+}
@@ -0,0 +1,186 @@
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// Learned index over a table's fence keys (the first key of each block). Keys
+// are mapped to numbers by the 8 bytes after the prefix all fences share, and a
+// piecewise linear model predicts a fence's position within FENCE_INDEX_ERROR.
+// Lookups search only around the prediction, and fall back to a binary search
+// over the whole table when the window does not hold the key.
+class FenceIndex
+{
+private:
+    struct Segment
+    {
+        uint64_t start; // Number of the first fence the line covers
+        int first;      // Position of that fence
+        double slope;   // Fences per unit of number
+    };
+
+    string prefix;
+    vector<uint64_t> numbers; // Number of each fence, non-decreasing
+    vector<Segment> segments;
+
+    // Big-endian value of the 8 bytes after the shared prefix, shorter keys padded with zeroes
+    uint64_t to_number(const string &key) const
+    {
+        uint64_t number = 0;
+        for (size_t i = 0; i < 8; i++)
+        {
+            size_t pos = prefix.size() + i;
+            number = (number << 8) | (pos < key.size() ? (uint8_t)key[pos] : 0);
+        }
+        return number;
+    }
+
+    // Fences with a number below (or not above, if inclusive) number, searched in [lo, hi)
+    size_t count_below(uint64_t number, bool inclusive, size_t lo, size_t hi, int *probes) const
+    {
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (probes != nullptr)
+                (*probes)++;
+            if (numbers[mid] < number || (inclusive && numbers[mid] == number))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Same as count_below over all fences, checking only the window the model predicts first
+    size_t count_near(uint64_t number, bool inclusive, size_t guess, int *probes) const
+    {
+        size_t n = numbers.size();
+        size_t lo = guess > (size_t)FENCE_INDEX_ERROR + 1 ? guess - FENCE_INDEX_ERROR - 1 : 0;
+        size_t hi = min(n, guess + FENCE_INDEX_ERROR + 2);
+        size_t count = count_below(number, inclusive, lo, hi, probes);
+        auto below = [&](size_t i)
+        { return numbers[i] < number || (inclusive && numbers[i] == number); };
+        if ((count == lo && lo > 0 && !below(lo - 1)) || (count == hi && hi < n && below(hi)))
+        {
+            if (probes != nullptr)
+                (*probes)++;
+            return count_below(number, inclusive, 0, n, probes);
+        }
+        if (probes != nullptr)
+            *probes += (count == lo && lo > 0) + (count == hi && hi < n);
+        return count;
+    }
+
+public:
+    bool empty() const
+    {
+        return segments.empty();
+    }
+
+    size_t num_segments() const
+    {
+        return segments.size();
+    }
+
+    // Fits the model, fences in key order. Leaves the index empty for tables too small
+    // to gain from it, or whose keys need a segment for every few fences.
+    void build(const vector<string> &fences)
+    {
+        prefix.clear();
+        numbers.clear();
+        segments.clear();
+        if (fences.size() < (size_t)FENCE_INDEX_MIN_BLOCKS)
+        {
+            return;
+        }
+
+        // Fences are sorted, so the first and the last share the prefix of all of them
+        const string &first = fences.front(), &last = fences.back();
+        size_t shared = 0;
+        while (shared < first.size() && shared < last.size() && first[shared] == last[shared])
+        {
+            shared++;
+        }
+        prefix = first.substr(0, shared);
+        numbers.reserve(fences.size());
+        for (const string &fence : fences)
+        {
+            numbers.push_back(to_number(fence));
+        }
+
+        // Greedy cone fit: extend a line from the segment's first fence while some
+        // slope keeps every fence so far within the error bound
+        double low = 0, high = 1e300;
+        Segment segment = {numbers[0], 0, 0};
+        for (size_t i = 1; i < numbers.size(); i++)
+        {
+            double dx = (double)(numbers[i] - segment.start);
+            double dy = (double)i - segment.first;
+            double new_low = low, new_high = high;
+            if (dx > 0)
+            {
+                new_low = max(low, (dy - FENCE_INDEX_ERROR) / dx);
+                new_high = min(high, (dy + FENCE_INDEX_ERROR) / dx);
+            }
+            if ((dx == 0 && dy > FENCE_INDEX_ERROR) || new_low > new_high)
+            {
+                segment.slope = high < 1e300 ? (low + high) / 2 : 0;
+                segments.push_back(segment);
+                segment = {numbers[i], (int)i, 0};
+                low = 0, high = 1e300;
+                continue;
+            }
+            low = new_low, high = new_high;
+        }
+        segment.slope = high < 1e300 ? (low + high) / 2 : 0;
+        segments.push_back(segment);
+
+        if (segments.size() * FENCE_INDEX_MIN_FANOUT > numbers.size())
+        {
+            prefix.clear();
+            numbers.clear();
+            segments.clear();
+        }
+    }
+
+    // Narrows [lo, hi) to the fences whose key may equal key: those before lo are
+    // below it and those from hi on above it. probes counts the comparisons made.
+    void bound(const string &key, size_t &lo, size_t &hi, int *probes = nullptr) const
+    {
+        int c = key.compare(0, prefix.size(), prefix);
+        if (c != 0)
+        {
+            // Outside the range the fences share, below or above all of them
+            lo = hi = c < 0 ? 0 : numbers.size();
+            return;
+        }
+
+        uint64_t number = to_number(key);
+        size_t seg_lo = 0, seg_hi = segments.size();
+        while (seg_lo < seg_hi)
+        {
+            size_t mid = seg_lo + (seg_hi - seg_lo) / 2;
+            if (probes != nullptr)
+                (*probes)++;
+            if (segments[mid].start <= number)
+                seg_lo = mid + 1;
+            else
+                seg_hi = mid;
+        }
+        if (seg_lo == 0)
+        {
+            lo = hi = 0;
+            return;
+        }
+
+        // Past its last fence a line is no longer bounded, the next segment's first fence caps the guess
+        const Segment &segment = segments[seg_lo - 1];
+        size_t limit = seg_lo < segments.size() ? segments[seg_lo].first : numbers.size() - 1;
+        double predicted = segment.first + segment.slope * (double)(number - segment.start);
+        size_t guess = (size_t)min(max(predicted, 0.0), (double)limit);
+
+        lo = count_near(number, false, guess, probes);
+        hi = lo < numbers.size() && numbers[lo] == number ? count_near(number, true, guess, probes) : lo;
+    }
+};
@@ -0,0 +1,119 @@
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// Latency histogram in the HdrHistogram layout: values below 128 have a bucket
+// each, above that every power of two is split into 64 buckets, so a recorded
+// value is known within 1/64 (two significant digits). Values are nanoseconds
+// up to about 18 minutes, larger ones land in the last bucket. One thread
+// records, any thread may read or merge meanwhile.
+class LatencyHistogram
+{
+private:
+    static const int SUB_BUCKETS = 64;
+    static const int MAX_SHIFT = 34; // 2^40 ns
+    static const int BUCKETS = 2 * SUB_BUCKETS + MAX_SHIFT * SUB_BUCKETS;
+    atomic<uint64_t> counts[BUCKETS] = {};
+    atomic<uint64_t> total{0}, sum{0}, max_value{0};
+
+    static int bucket_of(uint64_t value)
+    {
+        if (value < 2 * SUB_BUCKETS)
+        {
+            return value;
+        }
+        int shift = 63 - __builtin_clzll(value) - 6;
+        if (shift > MAX_SHIFT)
+        {
+            return BUCKETS - 1;
+        }
+        return 2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + (int)((value >> shift) - SUB_BUCKETS);
+    }
+
+    // The largest value a bucket holds
+    static uint64_t bucket_limit(int bucket)
+    {
+        if (bucket < 2 * SUB_BUCKETS)
+        {
+            return bucket;
+        }
+        int shift = (bucket - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+        uint64_t sub = (bucket - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    // Single writer, so a plain add and store is enough
+    static void add(atomic<uint64_t> &counter, uint64_t value)
+    {
+        counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+    }
+
+public:
+    void record(uint64_t value)
+    {
+        add(counts[bucket_of(value)], 1);
+        add(total, 1);
+        add(sum, value);
+        if (value > max_value.load(memory_order_relaxed))
+        {
+            max_value.store(value, memory_order_relaxed);
+        }
+    }
+
+    // Adds other's counts, for aggregating per-thread histograms into a fresh one
+    void merge(const LatencyHistogram &other)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            uint64_t count = other.counts[i].load(memory_order_relaxed);
+            if (count > 0)
+            {
+                add(counts[i], count);
+            }
+        }
+        add(total, other.total.load(memory_order_relaxed));
+        add(sum, other.sum.load(memory_order_relaxed));
+        max_value.store(std::max(max_value.load(memory_order_relaxed), other.max_value.load(memory_order_relaxed)),
+                        memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        return total.load(memory_order_relaxed);
+    }
+
+    double mean() const
+    {
+        uint64_t n = count();
+        return n == 0 ? 0 : (double)sum.load(memory_order_relaxed) / n;
+    }
+
+    uint64_t maximum() const
+    {
+        return max_value.load(memory_order_relaxed);
+    }
+
+    // Smallest value that at least percent % of the recorded values do not exceed,
+    // within the bucket precision
+    uint64_t percentile(double percent) const
+    {
+        uint64_t n = count();
+        if (n == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)(percent / 100 * n + 0.5));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i].load(memory_order_relaxed);
+            if (seen >= rank)
+            {
+                return min(bucket_limit(i), maximum());
+            }
+        }
+        return maximum();
+    }
+};
@@ -0,0 +1,160 @@
+#ifndef KV_H
+#define KV_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define KV_NOT_FOUND 0
+#define KV_FOUND 1
+#define KV_PENDING -1
+#define KV_ERROR -2 // Data could not be read or failed its checksum, or a write was not logged, see the server log
+
+// A value returned by the engine. data points into the memtable entry, the
+// data block or the row cache entry it was read from, and stays valid until RELEASE_VALUE even if
+// the key is overwritten or its SSTable is compacted away meanwhile.
+struct kv_value
+{
+    const char *data;
+    size_t len;
+    void *pin; // Engine reference keeping data alive
+};
+
+// Writes return KV_ERROR, and change nothing, if the write-ahead log append fails.
+// SET and MERGE return 0 otherwise.
+int SET(const char *key, size_t key_len, const char *value, size_t value_len);
+// Returns the number of values deleted, 0 or 1. A blind delete skips the
+// existence check and always writes the tombstone, reporting 1.
+int DEL(const char *key, size_t key_len, int blind);
+
+// Appends operand to the key's value, a missing or deleted key starts out empty.
+// The append is resolved lazily, by reads and compaction.
+int MERGE(const char *key, size_t key_len, const char *operand, size_t operand_len);
+
+// A key passed to DEL_ASYNC, copied by the call
+struct kv_key
+{
+    const char *data;
+    size_t len;
+};
+
+// DEL of every key in order, with the existence checks' block reads going
+// through io_uring like GET_ASYNC. Returns the number of values deleted, or
+// KV_PENDING if a check waits on disk: callback(ctx, deleted) then runs from
+// poll_async_io. KV_ERROR if a tombstone was not logged, the keys before it
+// stay deleted.
+int DEL_ASYNC(const struct kv_key *keys, size_t nkeys, int blind, void (*callback)(void *, int), void *ctx);
+
+// Writes applied together: one sequence range, one log append, and no memtable
+// flush in the middle. BATCH_DELETE returns 1 if the key has a value, counting
+// the batch's own earlier writes, and only then queues the tombstone. Its
+// existence check reads blocks synchronously, as the batch must be complete
+// before BATCH_WRITE.
+// BATCH_WRITE returns 0, or KV_ERROR with none of the writes applied.
+struct kv_batch;
+
+struct kv_batch *BATCH_NEW();
+void BATCH_PUT(struct kv_batch *batch, const char *key, size_t key_len, const char *value, size_t value_len);
+int BATCH_DELETE(struct kv_batch *batch, const char *key, size_t key_len, int blind);
+void BATCH_MERGE(struct kv_batch *batch, const char *key, size_t key_len, const char *operand, size_t operand_len);
+int BATCH_WRITE(struct kv_batch *batch);
+void BATCH_FREE(struct kv_batch *batch);
+
+// Opens the value log that large values are moved to when tables are written,
+// returns -1 if it cannot be created. Without it values stay in the tables.
+int start_value_log();
+
+// Opens the write-ahead log and replays it into the memtable, returns the
+// number of batches replayed or -1 if the log cannot be opened
+int start_wal();
+
+// Returns KV_FOUND with *value pinned, KV_NOT_FOUND for missing and deleted keys,
+// or KV_ERROR if data the answer depends on is unreadable
+int GET(const char *key, size_t key_len, struct kv_value *value);
+
+// Like GET but block reads go through io_uring. Returns KV_PENDING when a disk
+// read is needed, callback(ctx, found, value) then runs from poll_async_io.
+// The receiver of a found value owns its pin.
+int GET_ASYNC(const char *key, size_t key_len, struct kv_value *value,
+              void (*callback)(void *, int, struct kv_value *), void *ctx);
+
+void RELEASE_VALUE(struct kv_value *value);
+
+// A consistent read view of the whole store. Reads through it ignore later
+// writes, and the tables it references outlive compaction until it is released.
+struct kv_snapshot;
+struct kv_iterator;
+
+struct kv_snapshot *SNAPSHOT();
+void RELEASE_SNAPSHOT(struct kv_snapshot *snapshot);
+int GET_AT(struct kv_snapshot *snapshot, const char *key, size_t key_len, struct kv_value *value);
+
+// Iterates the live keys of a snapshot from start on, in key order. SCAN_NEXT
+// returns KV_FOUND with the key, valid until the next call, and the pinned
+// value, KV_NOT_FOUND at the end, or KV_ERROR once a block is unreadable, from
+// then on. The snapshot must outlive the iterator.
+struct kv_iterator *SCAN(struct kv_snapshot *snapshot, const char *start, size_t start_len);
+int SCAN_NEXT(struct kv_iterator *it, const char **key, size_t *key_len, struct kv_value *value);
+void SCAN_CLOSE(struct kv_iterator *it);
+
+// Links the tables sst_build wrote under path into the store as its oldest
+// data, without rewriting them. Returns the number of tables, -1 on error.
+int INGEST(const char *path, size_t path_len);
+
+// Writes delayed because compaction fell behind, writes that had to wait for it
+// to catch up, and the time all of them spent waiting (microseconds)
+struct kv_stall_stats
+{
+    unsigned long long delayed_writes;
+    unsigned long long stopped_writes;
+    unsigned long long stall_micros;
+};
+
+void STALL_STATS(struct kv_stall_stats *stats);
+
+// Server commands with a latency histogram each
+enum kv_command
+{
+    KV_CMD_GET,
+    KV_CMD_SET,
+    KV_CMD_DEL,
+    KV_CMD_MERGE,
+    KV_CMD_MSET,
+    KV_CMD_MULTI,
+    KV_CMD_EXEC,
+    KV_CMD_DISCARD,
+    KV_CMD_SCAN,
+    KV_CMD_INGEST,
+    KV_CMD_INFO,
+    KV_CMD_OTHER, // Queued inside MULTI, or rejected
+    KV_COMMANDS
+};
+
+// Whether to time the next command: one in STATS_SAMPLE_INTERVAL is
+int STATS_SAMPLE();
+
+// Counts a command, and records how long it took from its dispatch to its
+// reply unless nanos is negative (not timed)
+void STATS_RECORD_COMMAND(int command, long long nanos);
+
+// Writes the engine counters, gauges and latency percentiles as INFO text of
+// `name:value` lines, NUL terminated and cut to size. Returns the full length,
+// like snprintf.
+size_t STATS_INFO(char *buf, size_t size);
+
+// Writes STATS_INFO to stderr every STATS_DUMP_INTERVAL seconds, if it is not 0
+void start_stats_dump();
+
+// Returns the eventfd to watch for async read completions, -1 if GET_ASYNC always completes inline
+int start_async_io();
+void poll_async_io();
+void start_compaction();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KV_H
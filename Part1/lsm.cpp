@@ -1,69 +1,116 @@
 #include "HEADER.h"
+#include "kv.h"
 #include "avl_tree.cpp"
 #include "probabilistic_set.cpp"
+#include "async_io.cpp"
+#include "compression.cpp"
+#include "crc32c.cpp"
+#include "block_cache.cpp"
+#include "row_cache.cpp"
+#include "histogram.cpp"
+#include "stats.cpp"
+#include "block.cpp"
+#include "fence_index.cpp"
+#include "vlog.cpp"
+#include "rate_limiter.cpp"
+#include "build_pool.cpp"
+#include "table_file.cpp"
+#include "wal.cpp"
 // #include "synchronisation.cpp"
 #include <thread>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <map>
+#include <queue>
+#include <sstream>
+#include <unordered_map>
+#include <condition_variable>
 
 // Semaphore sem_compaction;
 // Semaphore sem_tree;
 
 
 mutex mtx_sstablelist;
+mutex mtx_compaction; // Held across a compaction step, whose slot indices must not shift
 AVLTree tree;
 
-int comp_time = MAX_COMP_TIME;
+// Folder names are never reused, a table may outlive its slot in SSTable_levels while a read pins it
+atomic<int> next_table_id{0};
 
-string encodeKeyValuePair(const string &key_str, const string &value_str)
+// A folder name for a new table. Tables are not reloaded on restart, so the
+// numbering starts over and names an earlier run left on disk are skipped.
+string new_table_folder()
 {
-    string result = key_str + DELIMITER + value_str + DELIMITER;
-    return result;
+    while (true)
+    {
+        string folder = "SSTable_" + to_string(next_table_id++);
+        if (!fs::exists(folder))
+        {
+            return folder;
+        }
+    }
 }
 
-pair<string, string> decodeKeyValuePair(const string &combinedStr)
-{
+// Sequence numbers order all writes, a larger one is newer
+atomic<uint64_t> next_seq{1};
 
-    size_t pos = combinedStr.find(DELIMITER);
-    string key_str, value_str;
+BlockCache block_cache(BLOCK_CACHE_SIZE);
+RowCache row_cache(ROW_CACHE_SIZE);
+Statistics statistics;
+ValueLog value_log;
+// Background table I/O: flushes at high priority, compaction and value log collection at low
+RateLimiter io_limiter(COMPACTION_RATE_LIMIT > 0 ? COMPACTION_RATE_MIN : 0);
 
-    if (pos != string::npos)
+// Wakes the compaction thread, which sleeps while no level needs compacting
+mutex mtx_compaction_signal;
+condition_variable compaction_cv;
+bool compaction_signalled = false;
+
+void signal_compaction()
+{
     {
-        key_str = combinedStr.substr(0, pos);
-        value_str = combinedStr.substr(pos + 1);
+        lock_guard<mutex> lock(mtx_compaction_signal);
+        compaction_signalled = true;
     }
-    value_str.pop_back();
-    return {key_str, value_str};
+    compaction_cv.notify_one();
 }
 
-// Function to split the string based on the delimiter
-vector<string> splitString(const string &str)
+string encodeRecord(const Record &record)
 {
-    vector<string> tokens;
-    string token;
-    for (char ch : str)
-    {
-        if (ch == DELIMITER)
-        {
-            if (!token.empty())
-            {
-                tokens.push_back(token);
-                token.clear();
-            }
-        }
-        else
-        {
-            token += ch;
-        }
-    }
-    if (!token.empty())
+    uint32_t key_len = record.key.size(), value_len = record.value.size();
+    string result(RECORD_HEADER_SIZE, '\0');
+    result[0] = static_cast<char>(record.type);
+    memcpy(&result[1], &record.seq, sizeof(uint64_t));
+    memcpy(&result[9], &key_len, sizeof(uint32_t));
+    memcpy(&result[13], &value_len, sizeof(uint32_t));
+    result += record.key;
+    result += record.value;
+    return result;
+}
+
+// Parses the record header at pos, returns false if the block ends inside the record
+bool decodeRecord(const char *data, size_t size, size_t pos, RecordRef &ref)
+{
+    if (size < RECORD_HEADER_SIZE || pos > size - RECORD_HEADER_SIZE)
     {
-        tokens.push_back(token);
+        return false;
     }
-    return tokens;
+    uint32_t key_len, value_len;
+    ref.type = static_cast<RecordType>(data[pos]);
+    memcpy(&ref.seq, data + pos + 1, sizeof(uint64_t));
+    memcpy(&key_len, data + pos + 9, sizeof(uint32_t));
+    memcpy(&value_len, data + pos + 13, sizeof(uint32_t));
+    ref.key_pos = pos + RECORD_HEADER_SIZE;
+    ref.key_len = key_len;
+    ref.value_pos = ref.key_pos + key_len;
+    ref.value_len = value_len;
+    return ref.value_pos + value_len <= size;
 }
 
-// Function to extract the integer pair at a specific index within a binary file
-pair<int32_t, int32_t> extractPair(const string &filename, int pair_idx)
+// Function to extract the integer pair at a specific index of the key index,
+// which starts at index_offset in a table's data file
+pair<int32_t, int32_t> extractPair(const string &filename, uint64_t index_offset, int pair_idx)
 {
     ifstream file(filename, ios::binary);
     if (!file)
@@ -73,7 +120,7 @@ pair<int32_t, int32_t> extractPair(const string &filename, int pair_idx)
     }
 
     // Calculate the offset: each pair takes 8 bytes (2 integers of 4 bytes each)
-    streampos offset = pair_idx * 8;
+    streampos offset = index_offset + (uint64_t)pair_idx * 8;
     file.seekg(offset, ios::beg);
 
     int32_t key, value;
@@ -89,43 +136,96 @@ pair<int32_t, int32_t> extractPair(const string &filename, int pair_idx)
     return {key, value};
 }
 
-string extractKeyValuePair(const string &filename, streampos position)
+// Reads size bytes at offset of a data file: one data block as stored, possibly compressed
+string readBlock(int fd, uint64_t offset, size_t size)
+{
+    string data(size, '\0');
+    size_t off = 0;
+    while (off < size)
+    {
+        ssize_t n = pread(fd, &data[off], size - off, offset + off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            throw runtime_error("Cannot read block at " + to_string(offset));
+        }
+        off += n;
+    }
+    return data;
+}
+
+// Appends the CRC32C of a block as stored, which every read from disk checks
+void putChecksum(string &block)
+{
+    uint32_t crc = crc32c(block.data(), block.size());
+    block.append(reinterpret_cast<const char *>(&crc), sizeof(crc));
+}
+
+// Whether a block as stored, checksum included, is intact
+bool checkBlock(const char *data, size_t size)
 {
-    ifstream inFile(filename, ios::binary);
-    if (!inFile)
+    if (size < BLOCK_CHECKSUM_SIZE)
     {
-        throw runtime_error("Cannot open file");
+        return false;
     }
+    uint32_t crc;
+    memcpy(&crc, data + size - BLOCK_CHECKSUM_SIZE, sizeof(crc));
+    return crc == crc32c(data, size - BLOCK_CHECKSUM_SIZE);
+}
 
-    inFile.seekg(position);
-    if (!inFile)
+// Verifies and decompresses a block as stored, nullptr if it is damaged
+shared_ptr<const string> decodeStoredBlock(const char *data, size_t size)
+{
+    if (!checkBlock(data, size))
     {
-        throw runtime_error("Invalid position in file");
+        return nullptr;
     }
+    return decodeBlock(data, size - BLOCK_CHECKSUM_SIZE);
+}
 
-    string result;
-    char ch;
-    int delimiterCount = 0;
+// Reads, verifies and decompresses a data block, bypassing the block cache
+shared_ptr<const string> loadBlock(int fd, uint64_t offset, size_t size)
+{
+    string data = readBlock(fd, offset, size);
+    shared_ptr<const string> block = decodeStoredBlock(data.data(), data.size());
+    if (block == nullptr)
+    {
+        throw runtime_error("Corrupt block at " + to_string(offset));
+    }
+    return block;
+}
 
-    while (inFile.get(ch))
+// Reads the record stored at position of the block at offset, as located by a
+// key index entry. Positions count from the start of the decompressed block.
+// The key may be prefix compressed, so the block is walked up to the record.
+Record extractRecord(int fd, uint64_t offset, size_t size, streampos position)
+{
+    shared_ptr<const string> block = loadBlock(fd, offset, size);
+    BlockIter it;
+    if (it.init(block->data(), block->size()))
     {
-        result += ch;
-        if (ch == DELIMITER)
+        for (size_t at = it.pos; it.next(); at = it.pos)
         {
-            delimiterCount++;
-            if (delimiterCount == 2)
+            if (at == (size_t)position)
             {
-                break;
+                return {it.key, block->substr(it.ref.value_pos, it.ref.value_len), it.ref.seq, it.ref.type};
             }
         }
     }
+    throw runtime_error("Invalid position in file");
+}
 
-    if (delimiterCount < 2)
+// Binary searches the restart points of a block for key, then scans one interval
+bool findInBlock(const char *data, size_t size, const string &key, RecordRef &ref)
+{
+    BlockIter it;
+    if (it.init(data, size) && it.seek(key) && it.key == key)
     {
-        throw runtime_error("Second occurrence of DELIMITER not found");
+        ref = it.ref;
+        return true;
     }
-
-    return result;
+    return false;
 }
 
 void createFolder(const string &folder_name)
@@ -179,7 +279,20 @@ void deleteFolder(const string& folder_name)
 
 
 class SSTable;
-vector<SSTable *> SSTable_list;
+
+// Tables by level, guarded by mtx_sstablelist. Level 0 holds flushed tables, oldest
+// first, whose key ranges may overlap. Every deeper level is one sorted run, tables
+// ordered by first key with disjoint ranges, holding older data than the levels above.
+vector<vector<shared_ptr<SSTable>>> SSTable_levels(1);
+
+// Location of one data block in the table's data file, and its first key
+struct BlockHandle
+{
+    string first_key;
+    int number;      // Position among the table's blocks
+    uint64_t offset; // In the data file
+    int size;        // On disk, possibly compressed
+};
 
 class SSTable
 {
@@ -188,14 +301,59 @@ private:
     string folder_name;
     ProbabilisticSet bfilter;
     int num_keys = 0;
+    vector<BlockHandle> blocks; // In-memory block index, sorted by first key
+    string last_key;
+    bool owns_files = true; // The folder is deleted with the table
+    BlockCodec block_codec;
+    vector<uint32_t> value_segments; // Value log segments the table points into
+    FenceIndex fence_index;          // Learned block index, empty when the table does not use one
+    uint64_t index_offset = 0;       // Where the key index starts in the data file
+    uint32_t index_crc = 0;          // CRC32C of the key index
+    int data_fd = -1;                // The data file, open for block reads
+    int direct_fd = -1;              // The data file opened with O_DIRECT, for async reads with USE_DIRECT_IO
+    bool built = false;              // Every write of the data file succeeded, and it was synced
+
+    // Opens a table written elsewhere, see open(). Only sst_build writes those, with the bottom codec.
+    explicit SSTable(const string &existing_folder) : folder_name(existing_folder), block_codec(BOTTOM_CODEC)
+    {
+    }
+
+    void close_data()
+    {
+        if (data_fd >= 0)
+        {
+            close(data_fd);
+        }
+        if (direct_fd >= 0)
+        {
+            close(direct_fd);
+        }
+        data_fd = direct_fd = -1;
+    }
+
+    bool open_data()
+    {
+        close_data();
+        data_fd = ::open(data_path().c_str(), O_RDONLY | O_CLOEXEC);
+        if (data_fd < 0)
+        {
+            cerr << "Error opening file: " << data_path() << endl;
+            return false;
+        }
+        if (USE_DIRECT_IO)
+        {
+            // Without O_DIRECT support async reads use data_fd
+            direct_fd = ::open(data_path().c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+        }
+        return true;
+    }
 
 public:
-    SSTable(const pair<int, pair<string, string> *> &data = {0, nullptr}, string fname=TOMBSTONE)
+    SSTable(const pair<int, Record *> &data = {0, nullptr}, string fname="", BlockCodec codec = FLUSH_CODEC)
     {
-        if(fname==TOMBSTONE)
+        if(fname.empty())
         {
-            int idx = SSTable_list.size();
-            folder_name = "SSTable_" + to_string(idx);
+            folder_name = new_table_folder();
         }
         else
         {
@@ -205,389 +363,2480 @@ public:
 
         // Extract the size and the data pointer
         num_keys = data.first;
-        pair<string, string> *keyval_array = data.second;
+        Record *records = data.second;
+        block_codec = codec;
 
-        // Dynamically allocate array for hashed data
-        string *hashed_data = new string[num_keys];
+        // Large values go to the value log, the table keeps pointers
+        value_segments = value_log.separate(records, num_keys);
 
+        // Blocks, key index and metadata go to one file, preallocated to the size of the records
+        uint64_t expected_size = 0;
         for (int i = 0; i < num_keys; ++i)
         {
-            // Encode key-value pairs and update Bloom filter
-            hashed_data[i] = encodeKeyValuePair(keyval_array[i].first, keyval_array[i].second);
-            bfilter.insert(keyval_array[i].first);
+            expected_size += RECORD_HEADER_SIZE + records[i].key.size() + records[i].value.size();
         }
+        TableFileWriter writer;
+        bool opened = writer.open(data_path(), expected_size);
+
+        // The filter is filled and the blocks compressed on the build pool, while
+        // this thread encodes the records into blocks
+        BuildPipeline pipeline(build_pool(), TABLE_BUILD_QUEUE_BLOCKS);
+        pipeline.run([this, records]
+                     {
+            for (int i = 0; i < num_keys; ++i)
+            {
+                // Update Bloom filter, deletes included so they shadow older tables
+                bfilter.insert(records[i].key);
+            } });
 
-        // Store hashed data and retrieve indices
-        int indices_size = 0;
-        pair<int, int> *indices = store_keyval_data(hashed_data, num_keys);
+        // Store the records in blocks and retrieve indices, once the pipeline is done
+        pair<int, int> *indices = store_keyval_data(records, num_keys, codec, pipeline, writer);
 
         // Store indices
-        store_keyval_index(indices, num_keys);
+        store_keyval_index(indices, num_keys, writer);
+
+        if (num_keys > 0)
+        {
+            last_key = records[num_keys - 1].key;
+        }
+        store_meta(writer);
+        // The values it points to are made durable with the table
+        built = writer.finish() && opened && value_log.sync(value_segments) && open_data();
+        build_fence_index();
 
         // Clean up dynamically allocated arrays
-        delete[] hashed_data;
         delete[] indices;
     }
     
+    SSTable(const SSTable &) = delete;
+
     ~SSTable()
     {
-        deleteFolder(folder_name);
+        close_data();
+        if (owns_files)
+        {
+            deleteFolder(folder_name);
+        }
+        value_log.unref(value_segments);
     }
 
-    int get_num_keys()
+    // Loads a table from its folder without reading the data blocks, nullptr if the
+    // metadata is missing or damaged. The files stay put until move_to adopts them.
+    static shared_ptr<SSTable> open(const string &folder_name)
     {
-        return num_keys;
+        shared_ptr<SSTable> table(new SSTable(folder_name));
+        table->owns_files = false;
+        if (!table->load_meta() || !table->open_data())
+        {
+            return nullptr;
+        }
+        table->build_fence_index();
+        return table;
     }
 
-    string get_folder_name()
+    // Leaves the folder in place when the table is destroyed, for tables built outside the store
+    void keep_files()
     {
-        return folder_name;
+        owns_files = false;
     }
 
-    pair<bool, string> find(const string key)
+    // Moves the table's files to a new folder, which the table then owns. It must not be read meanwhile.
+    bool move_to(const string &new_folder)
     {
-        if (bfilter.exists(key) && num_keys > 0)
+        error_code ec;
+        fs::rename(folder_name, new_folder, ec);
+        if (ec)
         {
-            int lo = 0, hi = num_keys - 1;
-            while (lo <= hi)
+            // Another filesystem, fall back to copying
+            fs::copy(folder_name, new_folder, fs::copy_options::recursive, ec);
+            if (ec)
             {
-                int mid = (lo + hi) / 2;
-                int file_idx = mid / INDEX_SIZE;
-                int pair_idx = mid % INDEX_SIZE;
-                string filename = folder_name + "/" + to_string(file_idx) + ".bin";
-
-                pair<int32_t, int32_t> result = extractPair(filename, pair_idx);
-                if (result.first == -1 || result.second == -1)
-                {
-                    // Handle the case where reading failed
-                    cerr << "Error: Could not read pair at index " << pair_idx << " in file " << filename << endl;
-                    exit(1);
-                }
-                int key_value_file_idx = result.first, key_value_pos_idx = result.second;
-                string key_value_filename = folder_name + "/" + to_string(key_value_file_idx) + ".txt";
-
-                string key_value = extractKeyValuePair(key_value_filename, key_value_pos_idx);
-                auto p = decodeKeyValuePair(key_value);
-                string curr_key = p.first, curr_value = p.second;
-
-                if (curr_key == key)
-                {
-                    return make_pair(true, curr_value);
-                }
-                else if (curr_key > key)
-                {
-                    hi = mid - 1;
-                }
-                else
-                {
-                    lo = mid + 1;
-                }
+                cerr << "Error moving table " << folder_name << ": " << ec.message() << endl;
+                fs::remove_all(new_folder, ec);
+                return false;
             }
+            fs::remove_all(folder_name, ec);
         }
-        return make_pair(false, TOMBSTONE);
+        folder_name = new_folder;
+        owns_files = true;
+        // A copy is another file, reads must not keep the removed one alive
+        return open_data();
     }
 
-    void store_keyval_index(const pair<int, int>* data, int num_pairs)
+    // False if the table could not be written, it must not be used then. Its folder goes with it.
+    bool is_built()
     {
-        const size_t maxPairsPerFile = INDEX_SIZE; // Maximum pairs per file
-        size_t fileIndex = 0;
-
-        for (int i = 0; i < num_pairs; i += maxPairsPerFile)
-        {
-            string filename = folder_name + "/" + to_string(fileIndex++) + ".bin";
-
-            ofstream outFile(filename, ios::binary);
-            if (!outFile)
-            {
-                cerr << "Error opening file: " << filename << endl;
-                return;
-            }
+        return built;
+    }
 
-            // Determine the number of pairs to write in this file
-            size_t pairsToWrite = min(static_cast<size_t>(maxPairsPerFile), static_cast<size_t>(num_pairs - i));
+    int get_num_keys()
+    {
+        return num_keys;
+    }
 
-            for (size_t j = 0; j < pairsToWrite; ++j)
-            {
-                outFile.write(reinterpret_cast<const char*>(&data[i + j].first), sizeof(int));
-                outFile.write(reinterpret_cast<const char*>(&data[i + j].second), sizeof(int));
-            }
+    string get_folder_name()
+    {
+        return folder_name;
+    }
 
-            outFile.close();
+    // Bytes of the data blocks on disk
+    size_t get_data_size()
+    {
+        size_t size = 0;
+        for (const BlockHandle &block : blocks)
+        {
+            size += block.size;
         }
+        return size;
     }
 
-    pair<int, int> *store_keyval_data(const string *data, int num_keys)
+    BlockCodec get_codec()
     {
-        const size_t maxFileSize = MAX_FILE_SIZE; // 4KB
-        pair<int, int> *fileOffsets = new pair<int, int>[num_keys];
-
-        int fileIndex = 0;
-        size_t currentFileSize = 0;
-        ofstream outFile;
-        string filename = folder_name + "/" + "0.txt";
-        outFile.open(filename);
+        return block_codec;
+    }
 
-        int offsetIndex = 0;
-        for (int i = 0; i < num_keys; ++i)
-        {
-            const string &str = data[i];
-            size_t newSize = currentFileSize + str.size() + 1;
+    bool references_segment(uint32_t segment)
+    {
+        return std::find(value_segments.begin(), value_segments.end(), segment) != value_segments.end();
+    }
 
-            // If adding the current string exceeds max file size, open a new file
-            if (newSize > maxFileSize)
-            {
-                outFile.close();
-                currentFileSize = 0;
-                filename = folder_name + "/" + to_string(++fileIndex) + ".txt";
-                outFile.open(filename);                         //TODO
-            }
+    // Key range of the table, only meaningful when it has keys
+    const string &get_first_key()
+    {
+        return blocks.front().first_key;
+    }
 
-            // Record the file index and current offset
-            fileOffsets[offsetIndex++] = {fileIndex, static_cast<int>(currentFileSize)};
+    const string &get_last_key()
+    {
+        return last_key;
+    }
 
-            // Write the string to the current file
-            outFile << str;
+    // Whether key lies between the table's smallest and largest key
+    bool covers(const string &key)
+    {
+        return num_keys > 0 && !(key < blocks.front().first_key) && !(last_key < key);
+    }
 
-            // Update the current file size
-            currentFileSize += str.size();
+    bool may_contain(const string &key)
+    {
+        if (num_keys == 0)
+        {
+            return false;
         }
-
-        outFile.close();
-
-        return fileOffsets;
+        statistics.add(FILTER_CHECKS);
+        if (!bfilter.exists(key))
+        {
+            statistics.add(FILTER_NEGATIVES);
+            return false;
+        }
+        return true;
     }
 
-};
+    // Finds the only block whose key range can hold key
+    bool locate_block(const string &key, BlockHandle &block)
+    {
+        // The fence index narrows the search to the blocks whose first key may equal key
+        size_t lo = 0, hi = blocks.size();
+        if (!fence_index.empty())
+        {
+            fence_index.bound(key, lo, hi);
+        }
+        auto it = upper_bound(blocks.begin() + lo, blocks.begin() + hi, key, [](const string &k, const BlockHandle &b)
+                              { return k < b.first_key; });
+        if (it == blocks.begin())
+        {
+            return false;
+        }
+        block = *prev(it);
+        return true;
+    }
 
-void create_SSTable(vector<pair<string, string>> &data)
-{
-    // Convert vector to dynamically allocated array
-    int num_keys = data.size();
-    pair<string, string>* data_array = new pair<string, string>[num_keys];
+    const vector<BlockHandle> &get_blocks()
+    {
+        return blocks;
+    }
 
-    for (int i = 0; i < num_keys; ++i)
+    string data_path()
     {
-        data_array[i] = data[i];
+        return folder_name + "/" + TABLE_DATA_FILE;
     }
 
-    // Create a pair containing the size and pointer to the array
-    pair<int, pair<string, string>*> data_pair = {num_keys, data_array};
-    
-    mtx_sstablelist.lock();
-    SSTable_list.push_back(new SSTable(data_pair));
-    mtx_sstablelist.unlock();
+    // The data file for async block reads, open as long as the table
+    int async_fd()
+    {
+        return direct_fd >= 0 ? direct_fd : data_fd;
+    }
 
-    // Clean up dynamically allocated array
-    delete[] data_array;
-}
+    // Names the block in the block cache, folder names are never reused
+    string block_key(const BlockHandle &block)
+    {
+        return folder_name + "/" + to_string(block.number);
+    }
 
-extern "C"{
-    void SET(char* key1,char* value1)
-    {      
-        if(comp_time<MAX_COMP_TIME)
+    // The decompressed block, from the block cache when it is there
+    shared_ptr<const string> read_block(const BlockHandle &block)
+    {
+        string key = block_key(block);
+        shared_ptr<const string> data = block_cache.lookup(key);
+        if (data == nullptr)
         {
-            comp_time *= 10;
+            statistics.add(BLOCK_CACHE_MISSES);
+            try
+            {
+                StageTimer timer(statistics, STAGE_BLOCK_READ);
+                data = loadBlock(data_fd, block.offset, block.size);
+            }
+            catch (const runtime_error &e)
+            {
+                throw runtime_error(folder_name + ": " + e.what());
+            }
+            block_cache.insert(key, data);
         }
-        string key = std::string(key1);
-        string value = std::string(value1);
-
-        tree.insert(key, value);
-        if (tree.size() == MAX_TREE_SIZE)
+        else
         {
-            vector<pair<string, string>> data = tree.getSortedPairs();
-            create_SSTable(data);
-            tree.clear();
+            statistics.add(BLOCK_CACHE_HITS);
         }
+        return data;
     }
 
-    void DEL(char* key)
-    {      
-        char* temp = "tombstone";
-        SET(key, temp);
+    // Every block as stored, read in one go from the start of the data file
+    string read_data()
+    {
+        if (blocks.empty())
+        {
+            return "";
+        }
+        return readBlock(data_fd, 0, blocks.back().offset + blocks.back().size);
     }
 
-    const char* GET(char* key1)
-    {     
-        string key = std::string(key1);
-        auto value = tree.find(key);
-        if (value.first)
+    // Checks every block and the key index against their checksums, the footer
+    // and metadata were checked when the table was opened. Returns what is
+    // damaged, empty if nothing is.
+    string verify()
+    {
+        string stored;
+        try
         {
-            return value.second.c_str();
+            stored = readBlock(data_fd, 0, index_offset + (uint64_t)num_keys * 2 * sizeof(int));
         }
-        if(comp_time>MIN_COMP_TIME)
+        catch (const runtime_error &)
         {
-            comp_time /= 10; 
+            return "cannot read the data file";
         }
-        mtx_sstablelist.lock();
-        for (int i = (int)SSTable_list.size() - 1; i >= 0; i--)
+        string damage;
+        for (const BlockHandle &block : blocks)
         {
-            if(SSTable_list[i] == nullptr)  continue;
-            value = SSTable_list[i]->find(key);
-            if (value.first)
-            {   
-                mtx_sstablelist.unlock();
-                return value.second.c_str();
+            if (!checkBlock(stored.data() + block.offset, block.size))
+            {
+                damage += "block " + to_string(block.number) + " at " + to_string(block.offset) + " corrupt; ";
             }
         }
-
-        mtx_sstablelist.unlock();
-        return TOMBSTONE.c_str();
+        if (crc32c(stored.data() + index_offset, stored.size() - index_offset) != index_crc)
+        {
+            damage += "key index corrupt; ";
+        }
+        return damage.empty() ? damage : damage.substr(0, damage.size() - 2);
     }
-}
 
-pair<string, string> *read_SSTable(string &folder_name, int data_size)
-{
-    auto *data = new pair<string, string>[data_size];
+    // On a hit value points into the block, which it keeps alive
+    bool find(const string &key, RecordRef &ref, shared_ptr<const char> &value)
+    {
+        BlockHandle block;
+        if (covers(key) && may_contain(key) && locate_block(key, block))
+        {
+            shared_ptr<const string> data = read_block(block);
+            if (findInBlock(data->data(), data->size(), key, ref))
+            {
+                value = shared_ptr<const char>(data, data->data() + ref.value_pos);
+                return true;
+            }
+            statistics.add(FILTER_FALSE_POSITIVES);
+        }
+        return false;
+    }
 
-    int idx = 0; // Current index in the array
-    for (int i = 0;; i++)
+    // Data file: the blocks, each followed by its CRC32C, the key index, the metadata,
+    // then the footer: metadata offset (8 bytes), metadata CRC32C, CRC32C of the two
+    // before it, TABLE_MAGIC (8). Metadata: num_keys, num_blocks, key index offset (8),
+    // key index CRC32C, per block (number, offset (8), size, key length, first key),
+    // last key length, last key, then the Bloom filter bits. Other integers are 4 bytes.
+    void store_meta(TableFileWriter &writer)
     {
-        string file_name = folder_name + "/" + to_string(i) + ".txt";
+        ostringstream out(ios::binary);
+        int num_blocks = blocks.size();
+        out.write(reinterpret_cast<const char *>(&num_keys), sizeof(int));
+        out.write(reinterpret_cast<const char *>(&num_blocks), sizeof(int));
+        out.write(reinterpret_cast<const char *>(&index_offset), sizeof(uint64_t));
+        out.write(reinterpret_cast<const char *>(&index_crc), sizeof(uint32_t));
+        for (const BlockHandle &block : blocks)
+        {
+            int key_len = block.first_key.size();
+            out.write(reinterpret_cast<const char *>(&block.number), sizeof(int));
+            out.write(reinterpret_cast<const char *>(&block.offset), sizeof(uint64_t));
+            out.write(reinterpret_cast<const char *>(&block.size), sizeof(int));
+            out.write(reinterpret_cast<const char *>(&key_len), sizeof(int));
+            out.write(block.first_key.data(), key_len);
+        }
+        int last_len = last_key.size();
+        out.write(reinterpret_cast<const char *>(&last_len), sizeof(int));
+        out.write(last_key.data(), last_len);
+        bfilter.save(out);
+
+        string meta = out.str();
+        string footer(TABLE_FOOTER_SIZE, '\0');
+        uint64_t meta_offset = writer.append(meta);
+        uint32_t meta_crc = crc32c(meta.data(), meta.size());
+        memcpy(&footer[0], &meta_offset, sizeof(uint64_t));
+        memcpy(&footer[8], &meta_crc, sizeof(uint32_t));
+        uint32_t footer_crc = crc32c(footer.data(), 12);
+        memcpy(&footer[12], &footer_crc, sizeof(uint32_t));
+        memcpy(&footer[16], &TABLE_MAGIC, sizeof(uint64_t));
+        writer.append(footer);
+    }
 
-        if (!fs::exists(file_name))
+    bool load_meta()
+    {
+        string filename = data_path();
+        ifstream file(filename, ios::binary);
+        if (!file)
         {
-            break;
+            cerr << "Error opening file: " << filename << endl;
+            return false;
+        }
+        error_code ec;
+        size_t file_size = fs::file_size(filename, ec);
+
+        // A file cut short by a crash has no footer
+        char footer[TABLE_FOOTER_SIZE];
+        uint64_t meta_offset, magic;
+        uint32_t meta_crc, footer_crc;
+        if (ec || file_size < TABLE_FOOTER_SIZE || !file.seekg(file_size - TABLE_FOOTER_SIZE) || !file.read(footer, TABLE_FOOTER_SIZE))
+        {
+            cerr << "Incomplete table file: " << filename << endl;
+            return false;
+        }
+        memcpy(&meta_offset, footer, sizeof(uint64_t));
+        memcpy(&meta_crc, footer + 8, sizeof(uint32_t));
+        memcpy(&footer_crc, footer + 12, sizeof(uint32_t));
+        memcpy(&magic, footer + 16, sizeof(uint64_t));
+        if (magic != TABLE_MAGIC || footer_crc != crc32c(footer, 12) || meta_offset > file_size - TABLE_FOOTER_SIZE)
+        {
+            cerr << "Incomplete table file: " << filename << endl;
+            return false;
         }
 
-        ifstream file(file_name);
-        if (!file.is_open())
+        string meta(file_size - TABLE_FOOTER_SIZE - meta_offset, '\0');
+        if (!file.seekg(meta_offset) || !file.read(&meta[0], meta.size()) || crc32c(meta.data(), meta.size()) != meta_crc)
         {
-            cerr << "Error opening file: " << file_name << endl;
-            continue;
+            cerr << "Corrupt table metadata: " << filename << endl;
+            return false;
         }
+        istringstream inFile(meta, ios::binary);
 
-        string line;
-        while (getline(file, line))
+        auto read_int = [&](int &value)
+        { return (bool)inFile.read(reinterpret_cast<char *>(&value), sizeof(int)) && value >= 0; };
+        auto read_string = [&](string &str)
+        {
+            int len;
+            if (!read_int(len) || (size_t)len > file_size)
+                return false;
+            str.resize(len);
+            return (bool)inFile.read(&str[0], len);
+        };
+
+        auto read_offset = [&](uint64_t &value)
+        { return (bool)inFile.read(reinterpret_cast<char *>(&value), sizeof(uint64_t)) && value <= meta_offset; };
+
+        int num_blocks;
+        if (!read_int(num_keys) || !read_int(num_blocks) || !read_offset(index_offset) ||
+            !inFile.read(reinterpret_cast<char *>(&index_crc), sizeof(uint32_t)))
+        {
+            return false;
+        }
+        blocks.resize(num_blocks);
+        for (BlockHandle &block : blocks)
         {
-            vector<string> tokens = splitString(line);
-            for (size_t j = 0; j < tokens.size(); j += 2)
+            if (!read_int(block.number) || !read_offset(block.offset) || !read_int(block.size) ||
+                !read_string(block.first_key) || block.offset + block.size > index_offset)
             {
-                string _key = tokens[j];
-                string _value = (j + 1 < tokens.size()) ? tokens[j + 1] : TOMBSTONE;
-                data[idx++] = {_key, _value};
+                return false;
             }
         }
-
-        file.close();
+        if (!read_string(last_key) || !bfilter.load(inFile))
+        {
+            return false;
+        }
+        return num_keys == 0 || !blocks.empty();
     }
 
-    return data;
-}
-
-pair<int, pair<string, string> *> mergeSortedSSTables(const pair<int, pair<string, string> *> &recent_sstable, const pair<int, pair<string, string> *> &old_sstable)
-{
-    int recent_size = recent_sstable.first;
-    int old_size = old_sstable.first;
-    pair<string, string> *recent_array = recent_sstable.second;
-    pair<string, string> *old_array = old_sstable.second;
-
-    int merged_size = recent_size + old_size;
-    pair<string, string> *merged_array = new pair<string, string>[merged_size];
-
-    int i = 0, j = 0, k = 0;
-
-    while (i < recent_size && j < old_size)
+    // Rebuilt from the block index when a table is opened rather than stored in the data file
+    void build_fence_index()
     {
-        if (recent_array[i].first < old_array[j].first)
-        {
-            merged_array[k++] = recent_array[i++];
-        }
-        else if (recent_array[i].first > old_array[j].first)
+        if (!USE_FENCE_INDEX || blocks.size() < (size_t)FENCE_INDEX_MIN_BLOCKS)
         {
-            merged_array[k++] = old_array[j++];
+            return;
         }
-        else
+        vector<string> fences;
+        fences.reserve(blocks.size());
+        for (const BlockHandle &block : blocks)
         {
-            merged_array[k++] = recent_array[i++];
-            j++;
+            fences.push_back(block.first_key);
         }
+        fence_index.build(fences);
     }
 
-    while (i < recent_size)
+    // Key index: the block number and the offset in the decompressed block of every record
+    void store_keyval_index(const pair<int, int>* data, int num_pairs, TableFileWriter &writer)
     {
-        merged_array[k++] = recent_array[i++];
+        string index;
+        index.reserve(num_pairs * 2 * sizeof(int));
+        for (int i = 0; i < num_pairs; ++i)
+        {
+            index.append(reinterpret_cast<const char*>(&data[i].first), sizeof(int));
+            index.append(reinterpret_cast<const char*>(&data[i].second), sizeof(int));
+        }
+        index_crc = crc32c(index.data(), index.size());
+        index_offset = writer.append(index);
     }
 
-    while (j < old_size)
+    // Encodes the records into blocks and has the pipeline compress each one.
+    // Blocks are appended to the data file in order, one compressed ahead of
+    // those before it waits for them. Returns once the pipeline is done.
+    pair<int, int> *store_keyval_data(const Record *records, int num_keys, BlockCodec codec, BuildPipeline &pipeline,
+                                      TableFileWriter &writer)
     {
-        merged_array[k++] = old_array[j++];
-    }
+        const size_t maxFileSize = MAX_FILE_SIZE - BLOCK_HEADER_SIZE - BLOCK_CHECKSUM_SIZE; // Fits 4KB even when stored uncompressed
+        pair<int, int> *fileOffsets = new pair<int, int>[num_keys];
 
-    pair<string, string> *resized_array = new pair<string, string>[k];
-    for (int idx = 0; idx < k; ++idx)
-    {
-        resized_array[idx] = merged_array[idx];
-    }
-    delete[] merged_array;
+        int fileIndex = 0;
+        BlockBuilder builder;
 
-    return {k, resized_array};
-}
+        mutex mtx_write;
+        map<int, string> compressed; // Blocks waiting for the ones before them, by number
+        int next_write = 0;
+        vector<pair<uint64_t, int>> placed(num_keys); // Offset and size of each block written
 
-void compact()
-{
-    // cout << " Compaction Thread: I am ready to compact!" << endl;
-    while (1)
-    {
-        int ll = -1, rr = -1;
-        bool make_compact = false;
-        if (SSTable_list.size() > 100)
+        auto writeBlock = [&]()
         {
-            mtx_sstablelist.lock();
-            rr = (int)SSTable_list.size() - 1, ll = rr - 1;
-            if (SSTable_list[rr] == nullptr)
-            {
-                SSTable_list.pop_back();
-                if (SSTable_list[ll] == nullptr)
+            pipeline.run([&, number = fileIndex, raw = builder.finish()]
+                         {
+                string encoded = encodeBlock(raw, codec);
+                putChecksum(encoded);
+                lock_guard<mutex> lock(mtx_write);
+                compressed[number] = std::move(encoded);
+                for (auto it = compressed.begin(); it != compressed.end() && it->first == next_write; it = compressed.erase(it))
                 {
-                    SSTable_list.pop_back();
-                }
+                    placed[next_write++] = {writer.append(it->second), (int)it->second.size()};
+                } });
+        };
+
+        int offsetIndex = 0;
+        for (int i = 0; i < num_keys; ++i)
+        {
+            // If adding the current record exceeds max file size, start a new block
+            if (builder.size_with(records[i]) > maxFileSize && !builder.empty())
+            {
+                writeBlock();
+                fileIndex++;
             }
-            else
+
+            if (builder.empty())
             {
-                if (SSTable_list[ll] == nullptr)
-                {
-                    SSTable_list[ll] = SSTable_list[rr];
-                    SSTable_list.pop_back();
-                }
-                else
-                {
-                    make_compact = true;
-                }
+                blocks.push_back({records[i].key, fileIndex, 0, 0});
             }
-            mtx_sstablelist.unlock();
+
+            // Record the block number and the offset inside the decompressed block
+            fileOffsets[offsetIndex++] = {fileIndex, static_cast<int>(builder.add(records[i]))};
         }
-        if(make_compact)
+        if (!builder.empty())
         {
-            int num_keys_ll = SSTable_list[ll]->get_num_keys(), num_keys_rr = SSTable_list[rr]->get_num_keys();
-            string folder_name_ll = SSTable_list[ll]->get_folder_name(), folder_name_rr = SSTable_list[rr]->get_folder_name();
-            pair<string, string> *keyval_ll = read_SSTable(folder_name_ll, num_keys_ll);
-            pair<string, string> *keyval_rr = read_SSTable(folder_name_rr, num_keys_rr);
-
-            pair<int, pair<string, string> *> keyval_comp = mergeSortedSSTables(make_pair(num_keys_rr, keyval_rr), make_pair(num_keys_ll, keyval_ll));
-
-            delete[] keyval_ll;
-            delete[] keyval_rr;
-
-            mtx_sstablelist.lock();
-            delete SSTable_list[ll];
-            delete SSTable_list[rr];
-            SSTable *table_comp = new SSTable(keyval_comp, folder_name_ll);
-            SSTable_list[ll] = table_comp;
-            SSTable_list[rr] = nullptr;
-            mtx_sstablelist.unlock();
-
-            delete[] keyval_comp.second;
-            keyval_comp.second = nullptr;
+            writeBlock();
+        }
+
+        // The jobs use this frame
+        pipeline.wait();
+        for (BlockHandle &block : blocks)
+        {
+            block.offset = placed[block.number].first;
+            block.size = placed[block.number].second;
+        }
+        return fileOffsets;
+    }
+
+};
+
+// The only table of a sorted level whose range can hold key, nullptr if there is none
+shared_ptr<SSTable> level_candidate(const vector<shared_ptr<SSTable>> &level, const string &key)
+{
+    auto it = upper_bound(level.begin(), level.end(), key, [](const string &k, const shared_ptr<SSTable> &table)
+                          { return k < table->get_first_key(); });
+    if (it == level.begin() || !(*prev(it))->covers(key))
+    {
+        return nullptr;
+    }
+    return *prev(it);
+}
+
+// Tables whose key range holds key, newest first. Level 0 tables are checked one by
+// one, every deeper level has at most one candidate, found by binary search.
+vector<shared_ptr<SSTable>> candidate_tables(const string &key)
+{
+    vector<shared_ptr<SSTable>> tables;
+    lock_guard<mutex> lock(mtx_sstablelist);
+    for (auto it = SSTable_levels[0].rbegin(); it != SSTable_levels[0].rend(); ++it)
+    {
+        if ((*it)->covers(key))
+        {
+            tables.push_back(*it);
+        }
+    }
+    for (size_t level = 1; level < SSTable_levels.size(); level++)
+    {
+        shared_ptr<SSTable> table = level_candidate(SSTable_levels[level], key);
+        if (table != nullptr)
+        {
+            tables.push_back(table);
+        }
+    }
+    return tables;
+}
+
+// Every table, newest first
+vector<shared_ptr<SSTable>> all_tables()
+{
+    lock_guard<mutex> lock(mtx_sstablelist);
+    vector<shared_ptr<SSTable>> tables(SSTable_levels[0].rbegin(), SSTable_levels[0].rend());
+    for (size_t level = 1; level < SSTable_levels.size(); level++)
+    {
+        tables.insert(tables.end(), SSTable_levels[level].begin(), SSTable_levels[level].end());
+    }
+    return tables;
+}
+
+// Keys a level below level 0 may hold before compaction moves tables out of it
+size_t level_max_keys(size_t level)
+{
+    size_t keys = LEVEL_BASE_KEYS;
+    for (size_t i = 1; i < level; i++)
+    {
+        keys *= LEVEL_SIZE_RATIO;
+    }
+    return keys;
+}
+
+// Write stalls: writes slow down as level 0 or the compaction debt grows past
+// its slowdown threshold, and wait once either reaches its stop threshold
+atomic<size_t> level0_tables{0};
+atomic<size_t> compaction_debt{0}; // Keys compaction must move before every level is within its size
+condition_variable stall_cv;       // Waits on mtx_sstablelist for the levels to shrink
+atomic<uint64_t> delayed_writes{0};
+atomic<uint64_t> stopped_writes{0};
+atomic<uint64_t> stall_micros{0};
+atomic<bool> compaction_failed{false}; // The last compaction hit damaged input, waiting for it would never end
+
+// Refreshes the counters writes are throttled on, after the levels changed.
+// Called with mtx_sstablelist held.
+void update_write_pressure()
+{
+    size_t debt = 0;
+    if (SSTable_levels[0].size() >= (size_t)L0_COMPACTION_TRIGGER)
+    {
+        for (const shared_ptr<SSTable> &table : SSTable_levels[0])
+        {
+            debt += table->get_num_keys();
+        }
+    }
+    for (size_t level = 1; level < SSTable_levels.size(); level++)
+    {
+        size_t keys = 0;
+        for (const shared_ptr<SSTable> &table : SSTable_levels[level])
+        {
+            keys += table->get_num_keys();
+        }
+        debt += keys > level_max_keys(level) ? keys - level_max_keys(level) : 0;
+    }
+    level0_tables = SSTable_levels[0].size();
+    compaction_debt = debt;
+    stall_cv.notify_all();
+
+    // Compaction runs at COMPACTION_RATE_MIN while it keeps up, and gets the whole
+    // COMPACTION_RATE_LIMIT once level 0 reaches its trigger or the debt half the
+    // slowdown threshold, well before writes are delayed
+    if (COMPACTION_RATE_LIMIT > 0)
+    {
+        double l0_pressure = (double)level0_tables / L0_COMPACTION_TRIGGER;
+        double debt_pressure = 2.0 * debt / COMPACTION_DEBT_SLOWDOWN_KEYS;
+        double pressure = min(1.0, max(l0_pressure, debt_pressure));
+        io_limiter.set_rate(COMPACTION_RATE_MIN + (COMPACTION_RATE_LIMIT - COMPACTION_RATE_MIN) * pressure);
+    }
+}
+
+// Writes are only delayed while compaction is failing, the levels may not shrink
+bool writes_stopped()
+{
+    return !compaction_failed && (level0_tables >= (size_t)L0_STOP_TABLES || compaction_debt >= COMPACTION_DEBT_STOP_KEYS);
+}
+
+// Delays a write while compaction is behind. The delay grows with how far level 0
+// and the debt are between their slowdown and stop thresholds, up to
+// WRITE_SLOWDOWN_MAX_DELAY microseconds, so write latency rises gradually
+// instead of jumping from nothing to a full stop.
+void throttle_write()
+{
+    size_t tables = level0_tables, debt = compaction_debt;
+    if (tables < (size_t)L0_SLOWDOWN_TABLES && debt < COMPACTION_DEBT_SLOWDOWN_KEYS)
+    {
+        return;
+    }
+
+    StageTimer timer(statistics, STAGE_WRITE_STALL);
+    auto start = chrono::steady_clock::now();
+    if (writes_stopped())
+    {
+        stopped_writes++;
+        cerr << "Stopping writes: " << tables << " level 0 tables, compaction debt " << debt << " keys" << endl;
+        signal_compaction();
+        unique_lock<mutex> lock(mtx_sstablelist);
+        stall_cv.wait(lock, []
+                      { return !writes_stopped(); });
+    }
+    else
+    {
+        delayed_writes++;
+        double l0_share = (double)((int)tables - L0_SLOWDOWN_TABLES + 1) / (L0_STOP_TABLES - L0_SLOWDOWN_TABLES + 1);
+        double debt_share = debt < COMPACTION_DEBT_SLOWDOWN_KEYS ? 0 : (double)(debt - COMPACTION_DEBT_SLOWDOWN_KEYS) / (COMPACTION_DEBT_STOP_KEYS - COMPACTION_DEBT_SLOWDOWN_KEYS);
+        usleep(WRITE_SLOWDOWN_MAX_DELAY * min(1.0, max(l0_share, debt_share)));
+    }
+    stall_micros += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Writes the records as a new level 0 table. Returns false, with the partial
+// table removed and the levels unchanged, if it could not be written.
+bool create_SSTable(vector<Record> &data)
+{
+    // Convert vector to dynamically allocated array
+    int num_keys = data.size();
+    Record* data_array = new Record[num_keys];
+
+    for (int i = 0; i < num_keys; ++i)
+    {
+        data_array[i] = data[i];
+    }
+
+    // Create a pair containing the size and pointer to the array
+    pair<int, Record*> data_pair = {num_keys, data_array};
+    
+    StageTimer timer(statistics, STAGE_FLUSH);
+    auto table = make_shared<SSTable>(data_pair);
+    delete[] data_array;
+    if (!table->is_built())
+    {
+        cerr << "Error writing table " << table->get_folder_name() << ", the memtable is kept" << endl;
+        return false;
+    }
+    io_limiter.request(table->get_data_size(), IO_HIGH);
+    statistics.add(FLUSHES);
+    statistics.add(BYTES_FLUSHED, table->get_data_size());
+    mtx_sstablelist.lock();
+    SSTable_levels[0].push_back(table);
+    bool compaction_due = SSTable_levels[0].size() >= (size_t)L0_COMPACTION_TRIGGER;
+    update_write_pressure();
+    mtx_sstablelist.unlock();
+    if (compaction_due)
+    {
+        signal_compaction();
+    }
+    return true;
+}
+
+// Links the tables sst_build wrote to the folders under path as a new bottom
+// level, without rewriting them. Their records carry sequence 0, so a backfill
+// never overrides a write already in the store. Returns the number of tables
+// linked, or -1 with none linked and the folders under path left as they were.
+int ingest_tables(const string &path)
+{
+    vector<shared_ptr<SSTable>> tables;
+    error_code ec;
+    for (const auto &entry : fs::directory_iterator(path, ec))
+    {
+        if (!entry.is_directory())
+        {
+            continue;
+        }
+        shared_ptr<SSTable> table = SSTable::open(entry.path().string());
+        if (table == nullptr)
+        {
+            cerr << "Ingest: no valid table in " << entry.path() << endl;
+            return -1;
+        }
+        if (table->get_num_keys() > 0)
+        {
+            tables.push_back(table);
+        }
+    }
+    if (ec)
+    {
+        cerr << "Ingest: cannot read " << path << ": " << ec.message() << endl;
+        return -1;
+    }
+
+    // Lookups stop at the first table holding a key, so ingested ranges must not overlap
+    sort(tables.begin(), tables.end(), [](const shared_ptr<SSTable> &a, const shared_ptr<SSTable> &b)
+         { return a->get_first_key() < b->get_first_key(); });
+    for (size_t i = 1; i < tables.size(); i++)
+    {
+        if (!(tables[i - 1]->get_last_key() < tables[i]->get_first_key()))
+        {
+            cerr << "Ingest: tables in " << path << " overlap" << endl;
+            return -1;
+        }
+    }
+
+    lock_guard<mutex> compaction_lock(mtx_compaction);
+    vector<string> sources;
+    size_t moved = 0;
+    for (; moved < tables.size(); moved++)
+    {
+        sources.push_back(tables[moved]->get_folder_name());
+        if (!tables[moved]->move_to(new_table_folder()))
+        {
+            break;
+        }
+    }
+    if (moved < tables.size())
+    {
+        // All or nothing: tables already moved go back where they came from
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            string folder = tables[i]->get_folder_name();
+            if (folder != sources[i] && !tables[i]->move_to(sources[i]) && tables[i]->get_folder_name() != sources[i])
+            {
+                cerr << "Ingest: table " << sources[i] << " is left in " << folder << endl;
+            }
+            tables[i]->keep_files();
+        }
+        return -1;
+    }
+
+    // The first level below every table already in the store
+    lock_guard<mutex> lock(mtx_sstablelist);
+    size_t level = SSTable_levels.size();
+    while (level > 1 && SSTable_levels[level - 1].empty())
+    {
+        level--;
+    }
+    if (level == SSTable_levels.size())
+    {
+        SSTable_levels.emplace_back();
+    }
+    SSTable_levels[level].assign(tables.begin(), tables.end());
+    row_cache.clear(); // Keys cached as absent may be in the new tables
+    update_write_pressure();
+    signal_compaction(); // The new level may be over its size
+    return tables.size();
+}
+
+// Whether key has a live value. Only the newest record matters, so unlike GET
+// this stops at the first table whose filter and block hold the key and never
+// materializes merge operands.
+bool key_exists(const string &key)
+{
+    shared_ptr<const Record> record = tree.find(key);
+    if (record != nullptr)
+    {
+        return record->type != RECORD_DELETE;
+    }
+
+    try
+    {
+        for (shared_ptr<SSTable> &table : candidate_tables(key))
+        {
+            RecordRef ref;
+            shared_ptr<const char> data;
+            if (table->find(key, ref, data))
+            {
+                return ref.type != RECORD_DELETE;
+            }
+        }
+    }
+    catch (const runtime_error &e)
+    {
+        // Unreadable data may hold the key, a tombstone is safe either way
+        cerr << e.what() << endl;
+        return true;
+    }
+    return false;
+}
+
+WriteAheadLog wal;
+
+// Adds a write to the memtable, a merge operand folds into the entry already there
+void apply_record(Record record)
+{
+    if (record.type == RECORD_MERGE)
+    {
+        shared_ptr<const Record> prev = tree.find(record.key);
+        if (prev != nullptr && prev->type != RECORD_DELETE)
+        {
+            record.value = prev->value + record.value;
+            record.type = prev->type;
+        }
+        else if (prev != nullptr)
+        {
+            // Nothing older survives a delete, the operand is the whole value
+            record.type = RECORD_PUT;
+        }
+    }
+    tree.insert(record);
+    if (row_cache.enabled())
+    {
+        row_cache.invalidate(record.key);
+    }
+}
+
+// Flushes a full memtable, which also retires the log covering it. If the
+// table cannot be written the memtable and the log stay, and the flush is
+// retried once another MAX_TREE_SIZE keys have come in.
+void maybe_flush_memtable()
+{
+    static int flush_size = MAX_TREE_SIZE;
+    if (tree.size() < flush_size)
+    {
+        return;
+    }
+    vector<Record> data = tree.getSortedRecords();
+    if (!create_SSTable(data))
+    {
+        flush_size = tree.size() + MAX_TREE_SIZE;
+        return;
+    }
+    flush_size = MAX_TREE_SIZE;
+    tree.clear();
+    wal.reset();
+}
+
+// Log entry: first sequence number (8 bytes), record count (4), encoded records
+string encodeBatch(const vector<Record> &records)
+{
+    uint32_t count = records.size();
+    string result(sizeof(uint64_t) + sizeof(count), '\0');
+    uint64_t first_seq = records.empty() ? 0 : records[0].seq;
+    memcpy(&result[0], &first_seq, sizeof(first_seq));
+    memcpy(&result[sizeof(first_seq)], &count, sizeof(count));
+    for (const Record &record : records)
+    {
+        result += encodeRecord(record);
+    }
+    return result;
+}
+
+// Applies the records as one unit: a consecutive sequence range, one log
+// append, and no memtable flush until all of them are in. Returns false, with
+// nothing applied, if the log append failed.
+bool write_batch(vector<Record> &records)
+{
+    if (records.empty())
+    {
+        return true;
+    }
+    throttle_write();
+
+    uint64_t first_seq = next_seq.fetch_add(records.size());
+    size_t bytes = 0;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        records[i].seq = first_seq + i;
+        bytes += records[i].key.size() + records[i].value.size();
+    }
+    statistics.add(KEYS_WRITTEN, records.size());
+    statistics.add(BYTES_WRITTEN, bytes);
+    {
+        StageTimer timer(statistics, STAGE_WAL_APPEND, statistics.sample(STAGE_WAL_APPEND));
+        string encoded = encodeBatch(records);
+        statistics.add(WAL_BYTES, encoded.size());
+        if (!wal.append(encoded))
+        {
+            return false;
+        }
+    }
+
+    for (Record &record : records)
+    {
+        apply_record(std::move(record));
+    }
+    maybe_flush_memtable();
+    return true;
+}
+
+bool write_record(Record record)
+{
+    vector<Record> records;
+    records.push_back(std::move(record));
+    return write_batch(records);
+}
+
+// Rebuilds the memtable from the batches logged since the last flush
+int replay_wal()
+{
+    int replayed = 0;
+    for (const string &batch : wal.read_all())
+    {
+        uint32_t count;
+        if (batch.size() < sizeof(uint64_t) + sizeof(count))
+        {
+            break;
+        }
+        memcpy(&count, batch.data() + sizeof(uint64_t), sizeof(count));
+
+        RecordRef ref;
+        size_t pos = sizeof(uint64_t) + sizeof(count);
+        for (uint32_t i = 0; i < count && decodeRecord(batch.data(), batch.size(), pos, ref); i++)
+        {
+            apply_record({batch.substr(ref.key_pos, ref.key_len), batch.substr(ref.value_pos, ref.value_len), ref.seq, ref.type});
+            if (ref.seq >= next_seq)
+            {
+                next_seq = ref.seq + 1;
+            }
+            pos = ref.value_pos + ref.value_len;
+        }
+        replayed++;
+    }
+    // Flushing only now keeps the log intact until everything is back in memory
+    maybe_flush_memtable();
+    return replayed;
+}
+
+// A write batch being built, nothing is visible until BATCH_WRITE
+struct kv_batch
+{
+    vector<Record> records;
+    unordered_map<string, bool> live; // Keys written so far, and whether they hold a value afterwards
+};
+
+extern "C"{
+    int SET(const char* key1, size_t key_len, const char* value1, size_t value_len)
+    {      
+        return write_record({string(key1, key_len), string(value1, value_len), 0, RECORD_PUT}) ? 0 : KV_ERROR;
+    }
+
+    int DEL(const char* key1, size_t key_len, int blind)
+    {      
+        string key = std::string(key1, key_len);
+        if (!blind && !key_exists(key))
+        {
+            // Nothing to hide, skip the tombstone
+            return 0;
+        }
+        return write_record({key, "", 0, RECORD_DELETE}) ? 1 : KV_ERROR;
+    }
+
+    int MERGE(const char* key, size_t key_len, const char* operand, size_t operand_len)
+    {
+        return write_record({string(key, key_len), string(operand, operand_len), 0, RECORD_MERGE}) ? 0 : KV_ERROR;
+    }
+
+    int start_wal()
+    {
+        if (!wal.open(WAL_PATH))
+        {
+            return -1;
+        }
+        return replay_wal();
+    }
+
+    struct kv_batch *BATCH_NEW()
+    {
+        return new kv_batch;
+    }
+
+    void BATCH_PUT(struct kv_batch *batch, const char* key, size_t key_len, const char* value, size_t value_len)
+    {
+        batch->records.push_back({string(key, key_len), string(value, value_len), 0, RECORD_PUT});
+        batch->live[batch->records.back().key] = true;
+    }
+
+    int BATCH_DELETE(struct kv_batch *batch, const char* key1, size_t key_len, int blind)
+    {
+        string key = std::string(key1, key_len);
+        auto it = batch->live.find(key);
+        bool exists = blind || (it != batch->live.end() ? it->second : key_exists(key));
+        if (!exists)
+        {
+            return 0;
+        }
+        batch->records.push_back({key, "", 0, RECORD_DELETE});
+        batch->live[key] = false;
+        return 1;
+    }
+
+    void BATCH_MERGE(struct kv_batch *batch, const char* key, size_t key_len, const char* operand, size_t operand_len)
+    {
+        batch->records.push_back({string(key, key_len), string(operand, operand_len), 0, RECORD_MERGE});
+        batch->live[batch->records.back().key] = true;
+    }
+
+    int BATCH_WRITE(struct kv_batch *batch)
+    {
+        bool logged = write_batch(batch->records);
+        batch->records.clear();
+        batch->live.clear();
+        return logged ? 0 : KV_ERROR;
+    }
+
+    void BATCH_FREE(struct kv_batch *batch)
+    {
+        delete batch;
+    }
+}
+
+// Hands a pinned value to the C caller
+int pin_value(struct kv_value *value, shared_ptr<const char> data, size_t len)
+{
+    value->data = data.get();
+    value->len = len;
+    value->pin = new shared_ptr<const char>(std::move(data));
+    return KV_FOUND;
+}
+
+// Resolves a key from the records met while walking from newest to oldest data.
+// Merge operands are collected until a put or delete gives their base value.
+struct Lookup
+{
+    bool merging = false;
+    string operands;
+    int found = KV_NOT_FOUND;
+
+    // Folds in the next older record, returns true once the value is known
+    bool add(RecordType type, shared_ptr<const char> data, size_t len, struct kv_value *value)
+    {
+        if (type == RECORD_VALUE_REF)
+        {
+            // A put whose value is read from the value log, an unreadable one fails like a corrupt block
+            shared_ptr<const string> stored = value_log.read(data.get(), len);
+            if (stored == nullptr)
+            {
+                throw runtime_error("Unreadable value log entry");
+            }
+            return add(RECORD_PUT, shared_ptr<const char>(stored, stored->data()), stored->size(), value);
+        }
+        if (type == RECORD_MERGE)
+        {
+            operands.insert(0, data.get(), len);
+            merging = true;
+            return false;
+        }
+        if (type == RECORD_PUT && !merging)
+        {
+            found = pin_value(value, std::move(data), len);
+            return true;
+        }
+        if (type == RECORD_PUT)
+        {
+            operands.insert(0, data.get(), len);
+        }
+        finish(value);
+        return true;
+    }
+
+    // No older record, or a delete: merge operands stand on their own
+    void finish(struct kv_value *value)
+    {
+        if (!merging)
+        {
+            found = KV_NOT_FOUND;
+            return;
+        }
+        auto merged = make_shared<const string>(std::move(operands));
+        found = pin_value(value, shared_ptr<const char>(merged, merged->data()), merged->size());
+    }
+};
+
+// Feeds the memtable record for key to lookup, returns true if it decided the value
+bool memtable_lookup(const string &key, Lookup &lookup, struct kv_value *value)
+{
+    shared_ptr<const Record> record = tree.find(key);
+    if (record == nullptr)
+    {
+        return false;
+    }
+    return lookup.add(record->type, shared_ptr<const char>(record, record->value.data()), record->value.size(), value);
+}
+
+// Whether a lookup the memtable left open may use the row cache: merge operands
+// from the memtable still need the tables' value
+bool use_row_cache(const Lookup &lookup)
+{
+    return !lookup.merging && row_cache.enabled();
+}
+
+// Answers a lookup from the row cache, true on a hit. On a miss fill_seq is set for fill_row_cache.
+bool row_cache_lookup(const string &key, Lookup &lookup, struct kv_value *value, uint64_t &fill_seq)
+{
+    shared_ptr<const string> cached;
+    if (!row_cache.lookup(key, cached, fill_seq))
+    {
+        return false;
+    }
+    lookup.found = cached == nullptr ? KV_NOT_FOUND : pin_value(value, shared_ptr<const char>(cached, cached->data()), cached->size());
+    return true;
+}
+
+// Offers the tables' answer for key to the row cache, errors are not cached
+void fill_row_cache(const string &key, uint64_t fill_seq, int found, const struct kv_value *value)
+{
+    if (found == KV_FOUND)
+    {
+        row_cache.insert(key, make_shared<const string>(value->data, value->len), fill_seq);
+    }
+    else if (found == KV_NOT_FOUND)
+    {
+        row_cache.insert(key, nullptr, fill_seq);
+    }
+}
+
+extern "C"{
+    int GET(const char* key1, size_t key_len, struct kv_value *value)
+    {     
+        string key = std::string(key1, key_len);
+        Lookup lookup;
+        if (memtable_lookup(key, lookup, value))
+        {
+            statistics.add(GETS_MEMTABLE);
+            return lookup.found;
+        }
+        uint64_t fill_seq;
+        bool cacheable = use_row_cache(lookup);
+        if (cacheable && row_cache_lookup(key, lookup, value, fill_seq))
+        {
+            statistics.add(GETS_ROW_CACHE);
+            return lookup.found;
+        }
+        // The candidates stay pinned while their blocks are read, compaction may replace them meanwhile
+        statistics.add(GETS_TABLES);
+        try
+        {
+            StageTimer timer(statistics, STAGE_TABLE_LOOKUP, statistics.sample(STAGE_TABLE_LOOKUP));
+            bool decided = false;
+            for (shared_ptr<SSTable> &table : candidate_tables(key))
+            {
+                RecordRef ref;
+                shared_ptr<const char> data;
+                if (table->find(key, ref, data) && lookup.add(ref.type, std::move(data), ref.value_len, value))
+                {
+                    decided = true;
+                    break;
+                }
+            }
+            if (!decided)
+            {
+                lookup.finish(value);
+            }
+        }
+        catch (const runtime_error &e)
+        {
+            cerr << e.what() << endl;
+            statistics.add(READ_ERRORS);
+            return KV_ERROR;
+        }
+
+        if (cacheable)
+        {
+            fill_row_cache(key, fill_seq, lookup.found, value);
+        }
+        return lookup.found;
+    }
+
+    void RELEASE_VALUE(struct kv_value *value)
+    {
+        delete static_cast<shared_ptr<const char> *>(value->pin);
+        value->pin = nullptr;
+    }
+}
+
+AsyncReader async_reader;
+bool async_io_enabled = false;
+
+// A GET waiting on block reads, tables are pinned until it finishes
+struct AsyncGet
+{
+    string key;
+    vector<shared_ptr<SSTable>> tables; // Candidates, newest first
+    size_t next = 0;
+    Lookup lookup;
+    struct kv_value value = {nullptr, 0, nullptr};
+    bool cacheable = false; // The result goes to the row cache
+    uint64_t fill_seq = 0;
+    bool timed = false; // The table lookup is sampled, it started at started
+    chrono::steady_clock::time_point started;
+    bool value_pending = false; // The value is being read from the value log, that read finishes the GET
+    bool exists_only = false;   // A DEL's existence check: the newest record decides, no value is read
+    void (*callback)(void *, int, struct kv_value *);
+    void *ctx;
+};
+
+// Table lookup of a GET_ASYNC done, inline or from a read completion
+void record_async_get(AsyncGet *op)
+{
+    if (op->exists_only)
+    {
+        return;
+    }
+    statistics.record_stage(STAGE_TABLE_LOOKUP, op->timed ? chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - op->started).count() : -1);
+    if (op->lookup.found == KV_ERROR)
+    {
+        statistics.add(READ_ERRORS);
+    }
+}
+
+// Completes the GET, unless a value log read still has to
+void finish_async_get(AsyncGet *op)
+{
+    if (op->value_pending)
+    {
+        return;
+    }
+    record_async_get(op);
+    if (op->cacheable)
+    {
+        fill_row_cache(op->key, op->fill_seq, op->lookup.found, &op->value);
+    }
+    op->callback(op->ctx, op->lookup.found, &op->value);
+    delete op;
+}
+
+// Reads the value a pointer refers to through the async reader, then finishes the GET with it
+void read_logged_value(AsyncGet *op, const char *pointer, size_t len)
+{
+    shared_ptr<const int> fd;
+    uint64_t offset;
+    size_t size;
+    if (!value_log.locate(pointer, len, fd, offset, size))
+    {
+        cerr << "Dangling value log pointer" << endl;
+        op->lookup.found = KV_ERROR;
+        return;
+    }
+    op->value_pending = true;
+    async_reader.read(*fd, offset, size, [op, fd, offset, size](shared_ptr<const char> data, int n)
+                      {
+        op->value_pending = false;
+        shared_ptr<const string> value = n == (int)size ? ValueLog::check_entry(data.get(), n) : nullptr;
+        data.reset();
+        if (value == nullptr)
+        {
+            cerr << "Unreadable value log entry at " << offset << endl;
+            op->lookup.found = KV_ERROR;
+        }
+        else
+        {
+            op->lookup.add(RECORD_PUT, shared_ptr<const char>(value, value->data()), value->size(), &op->value);
+        }
+        finish_async_get(op); });
+}
+
+// Folds a record into op's lookup, true once that decided the GET. A value in
+// the value log is read asynchronously, op->value_pending is set meanwhile. An
+// unreadable value log entry decides the GET as an error, as a corrupt block does.
+bool add_to_lookup(AsyncGet *op, const RecordRef &ref, shared_ptr<const char> data)
+{
+    if (op->exists_only)
+    {
+        op->lookup.found = ref.type == RECORD_DELETE ? KV_NOT_FOUND : KV_FOUND;
+        return true;
+    }
+    if (ref.type == RECORD_VALUE_REF)
+    {
+        read_logged_value(op, data.get(), ref.value_len);
+        return true;
+    }
+    try
+    {
+        return op->lookup.add(ref.type, std::move(data), ref.value_len, &op->value);
+    }
+    catch (const runtime_error &e)
+    {
+        cerr << e.what() << endl;
+        op->lookup.found = KV_ERROR;
+        return true;
+    }
+}
+
+// Searches the candidates whose blocks are cached, up to the first one that needs
+// a read. True if that decided the GET, the result is then in op->value.
+bool resolve_cached(AsyncGet *op)
+{
+    while (op->next < op->tables.size())
+    {
+        BlockHandle block;
+        op->tables[op->next]->locate_block(op->key, block);
+        shared_ptr<const string> cached = block_cache.lookup(op->tables[op->next]->block_key(block));
+        if (cached == nullptr)
+        {
+            return false;
+        }
+        statistics.add(BLOCK_CACHE_HITS);
+        op->next++;
+
+        RecordRef ref;
+        if (!findInBlock(cached->data(), cached->size(), op->key, ref))
+        {
+            statistics.add(FILTER_FALSE_POSITIVES);
+        }
+        else if (add_to_lookup(op, ref, shared_ptr<const char>(cached, cached->data() + ref.value_pos)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Submits the block read for the next candidate table, or finishes the GET
+void continue_async_get(AsyncGet *op)
+{
+    if (resolve_cached(op))
+    {
+        finish_async_get(op);
+        return;
+    }
+    while (op->next < op->tables.size())
+    {
+        shared_ptr<SSTable> table = op->tables[op->next++];
+        BlockHandle block;
+        if (!table->locate_block(op->key, block))
+        {
+            continue;
+        }
+
+        string key = table->block_key(block);
+        statistics.add(BLOCK_CACHE_MISSES);
+        auto read_start = chrono::steady_clock::now();
+        async_reader.read(table->async_fd(), block.offset, block.size, [op, table, key, block, read_start](shared_ptr<const char> data, int n)
+                          {
+            if (n < 0)
+            {
+                cerr << "Error reading block of " << table->get_folder_name() << ": " << strerror(-n) << endl;
+                op->lookup.found = KV_ERROR;
+                finish_async_get(op);
+                return;
+            }
+
+            // The read buffer goes back to the pool, values point into the decoded copy
+            shared_ptr<const string> decoded = n == block.size ? decodeStoredBlock(data.get(), n) : nullptr;
+            data.reset();
+            statistics.record_stage(STAGE_BLOCK_READ, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - read_start).count());
+            if (decoded == nullptr)
+            {
+                cerr << "Corrupt block " << key << endl;
+                op->lookup.found = KV_ERROR;
+                finish_async_get(op);
+                return;
+            }
+            block_cache.insert(key, decoded);
+            RecordRef ref;
+            if (!findInBlock(decoded->data(), decoded->size(), op->key, ref))
+            {
+                statistics.add(FILTER_FALSE_POSITIVES);
+            }
+            else if (add_to_lookup(op, ref, shared_ptr<const char>(decoded, decoded->data() + ref.value_pos)))
+            {
+                finish_async_get(op);
+                return;
+            }
+            continue_async_get(op); });
+        return;
+    }
+    op->lookup.finish(&op->value);
+    finish_async_get(op);
+}
+
+// Looks op->key up in the tables, once the memtable and row cache could not
+// answer. Returns KV_PENDING if a read is needed, op then finishes through its
+// callback. Otherwise returns the result with a found value in *value, op is freed.
+int lookup_tables_async(AsyncGet *op, struct kv_value *value)
+{
+    BlockHandle block;
+    for (shared_ptr<SSTable> &table : candidate_tables(op->key))
+    {
+        if (table->may_contain(op->key) && table->locate_block(op->key, block))
+        {
+            op->tables.push_back(table);
+        }
+    }
+
+    // Blocks in the block cache answer inline, the callback only runs for disk reads
+    bool decided = resolve_cached(op);
+    if (op->value_pending)
+    {
+        return KV_PENDING;
+    }
+    if (decided || op->next == op->tables.size())
+    {
+        if (!decided)
+        {
+            // Every Bloom filter and block index ruled the key out, or the cached blocks did
+            op->lookup.finish(&op->value);
+        }
+        record_async_get(op);
+        if (op->cacheable)
+        {
+            fill_row_cache(op->key, op->fill_seq, op->lookup.found, &op->value);
+        }
+        *value = op->value;
+        int found = op->lookup.found;
+        delete op;
+        return found;
+    }
+
+    continue_async_get(op);
+    return KV_PENDING;
+}
+
+// A DEL whose existence checks go through the async reader. The keys are
+// copied, the command's buffer may move while a check waits on a read.
+struct AsyncDel
+{
+    vector<string> keys;
+    size_t next = 0; // Key being checked, those before it are done
+    int deleted = 0;
+    void (*callback)(void *, int);
+    void *ctx;
+};
+
+// The memtable's say on whether key has a value, KV_PENDING if it holds no record of it
+int memtable_exists(const string &key)
+{
+    shared_ptr<const Record> record = tree.find(key);
+    if (record == nullptr)
+    {
+        return KV_PENDING;
+    }
+    return record->type == RECORD_DELETE ? KV_NOT_FOUND : KV_FOUND;
+}
+
+// Writes the tombstone of a key the check found, or could not read: an
+// unreadable block may hold the key, and a tombstone is safe either way.
+// Returns the number of values deleted or KV_ERROR.
+int delete_checked(const string &key, int found)
+{
+    if (found == KV_NOT_FOUND)
+    {
+        return 0;
+    }
+    return write_record({key, "", 0, RECORD_DELETE}) ? 1 : KV_ERROR;
+}
+
+void async_del_checked(void *ctx, int found, struct kv_value *value);
+
+// Checks and deletes the keys from del->next on. Returns KV_PENDING while a
+// check waits on a read, which resumes it, else the number deleted or KV_ERROR.
+int continue_async_del(AsyncDel *del)
+{
+    while (del->next < del->keys.size())
+    {
+        const string &key = del->keys[del->next];
+        int found = memtable_exists(key);
+        if (found == KV_PENDING)
+        {
+            AsyncGet *op = new AsyncGet;
+            op->key = key;
+            op->exists_only = true;
+            op->callback = async_del_checked;
+            op->ctx = del;
+            struct kv_value unused;
+            found = lookup_tables_async(op, &unused);
+            if (found == KV_PENDING)
+            {
+                return KV_PENDING;
+            }
+        }
+        int ret = delete_checked(key, found);
+        if (ret == KV_ERROR)
+        {
+            return KV_ERROR;
+        }
+        del->deleted += ret;
+        del->next++;
+    }
+    return del->deleted;
+}
+
+// Completion of a DEL's existence check that read from disk
+void async_del_checked(void *ctx, int found, struct kv_value *)
+{
+    AsyncDel *del = static_cast<AsyncDel *>(ctx);
+    // A write to the key while the block was read is newer than the tables' record
+    int newer = memtable_exists(del->keys[del->next]);
+    int ret = delete_checked(del->keys[del->next], newer != KV_PENDING ? newer : found);
+    if (ret != KV_ERROR)
+    {
+        del->deleted += ret;
+        del->next++;
+        ret = continue_async_del(del);
+    }
+    if (ret == KV_PENDING)
+    {
+        return;
+    }
+    del->callback(del->ctx, ret);
+    delete del;
+}
+
+extern "C"{
+    int start_async_io()
+    {
+        int fd = async_reader.init(USE_DIRECT_IO);
+        async_io_enabled = fd >= 0;
+        return fd;
+    }
+
+    // Runs completion callbacks of finished block reads
+    void poll_async_io()
+    {
+        if (async_io_enabled)
+        {
+            async_reader.poll();
+        }
+    }
+
+    int GET_ASYNC(const char* key1, size_t key_len, struct kv_value *value, void (*callback)(void*, int, struct kv_value*), void* ctx)
+    {
+        if (!async_io_enabled)
+        {
+            return GET(key1, key_len, value);
+        }
+
+        AsyncGet *op = new AsyncGet;
+        op->key = std::string(key1, key_len);
+        op->callback = callback;
+        op->ctx = ctx;
+
+        if (memtable_lookup(op->key, op->lookup, value))
+        {
+            statistics.add(GETS_MEMTABLE);
+            int found = op->lookup.found;
+            delete op;
+            return found;
+        }
+        op->cacheable = use_row_cache(op->lookup);
+        if (op->cacheable && row_cache_lookup(op->key, op->lookup, value, op->fill_seq))
+        {
+            statistics.add(GETS_ROW_CACHE);
+            int found = op->lookup.found;
+            delete op;
+            return found;
+        }
+        statistics.add(GETS_TABLES);
+        op->timed = statistics.sample(STAGE_TABLE_LOOKUP);
+        if (op->timed)
+        {
+            op->started = chrono::steady_clock::now();
+        }
+
+        return lookup_tables_async(op, value);
+    }
+
+    int DEL_ASYNC(const struct kv_key *keys, size_t nkeys, int blind, void (*callback)(void*, int), void* ctx)
+    {
+        AsyncDel *del = new AsyncDel;
+        for (size_t i = 0; i < nkeys; i++)
+        {
+            del->keys.emplace_back(keys[i].data, keys[i].len);
+        }
+        del->callback = callback;
+        del->ctx = ctx;
+
+        int ret;
+        if (blind || !async_io_enabled)
+        {
+            ret = 0;
+            for (const string &key : del->keys)
+            {
+                int n = DEL(key.data(), key.size(), blind);
+                if (n == KV_ERROR)
+                {
+                    ret = KV_ERROR;
+                    break;
+                }
+                ret += n;
+            }
+        }
+        else
+        {
+            ret = continue_async_del(del);
+        }
+        if (ret != KV_PENDING)
+        {
+            delete del;
+        }
+        return ret;
+    }
+}
+
+// A consistent read view. It holds the memtable records as of the snapshot and
+// the tables that were live then, which stay on disk while pinned here even if
+// compaction replaces them. Neither writes nor compaction wait for it.
+struct kv_snapshot
+{
+    uint64_t seq; // Writes up to this sequence number are visible
+    vector<shared_ptr<const Record>> memtable; // Sorted by key
+    vector<shared_ptr<SSTable>> tables;        // Newest first
+};
+
+// One input of a scan, the memtable or a table, positioned on its current record
+struct ScanSource
+{
+    bool valid = false;
+    string key;
+    RecordType type;
+    uint64_t seq;
+    shared_ptr<const char> value;
+    size_t value_len;
+
+    // Memtable source
+    const vector<shared_ptr<const Record>> *records = nullptr;
+    size_t record_idx = 0;
+
+    // Table source, read a block at a time
+    shared_ptr<SSTable> table;
+    size_t block_idx = 0;
+    shared_ptr<const string> block;
+    BlockIter iter;
+
+    // Positions on the first record with a key not below start
+    void seek(const string &start)
+    {
+        if (records != nullptr)
+        {
+            record_idx = lower_bound(records->begin(), records->end(), start, [](const shared_ptr<const Record> &r, const string &k)
+                                     { return r->key < k; }) - records->begin();
+            load_record();
+            return;
+        }
+
+        BlockHandle handle;
+        const vector<BlockHandle> &blocks = table->get_blocks();
+        if (table->locate_block(start, handle))
+        {
+            for (block_idx = 0; blocks[block_idx].number != handle.number; block_idx++)
+            {
+            }
+        }
+        load_block();
+        while (valid && key < start)
+        {
+            next();
+        }
+    }
+
+    void next()
+    {
+        if (records != nullptr)
+        {
+            record_idx++;
+            load_record();
+            return;
+        }
+        if (!load_from_block())
+        {
+            block_idx++;
+            load_block();
+        }
+    }
+
+private:
+    void load_record()
+    {
+        valid = record_idx < records->size();
+        if (valid)
+        {
+            const shared_ptr<const Record> &record = (*records)[record_idx];
+            key = record->key;
+            type = record->type;
+            seq = record->seq;
+            value = shared_ptr<const char>(record, record->value.data());
+            value_len = record->value.size();
+        }
+    }
+
+    bool load_from_block()
+    {
+        if (block == nullptr || !iter.next())
+        {
+            return false;
+        }
+        valid = true;
+        key = iter.key;
+        type = iter.ref.type;
+        seq = iter.ref.seq;
+        value = shared_ptr<const char>(block, block->data() + iter.ref.value_pos);
+        value_len = iter.ref.value_len;
+        return true;
+    }
+
+    // Loads blocks from block_idx on until one yields a record
+    void load_block()
+    {
+        const vector<BlockHandle> &blocks = table->get_blocks();
+        for (; block_idx < blocks.size(); block_idx++)
+        {
+            block = table->read_block(blocks[block_idx]);
+            if (iter.init(block->data(), block->size()) && load_from_block())
+            {
+                return;
+            }
+        }
+        block = nullptr;
+        valid = false;
+    }
+};
+
+// Merges the sources of a snapshot into live keys in order
+struct kv_iterator
+{
+    kv_snapshot *snapshot;
+    vector<ScanSource> sources;
+    string key;          // Current key, returned to the caller
+    bool failed = false; // A block could not be read, the scan cannot go on
+
+    // Smallest key first, newest record first among equal keys
+    struct HeapOrder
+    {
+        const vector<ScanSource> *sources;
+        bool operator()(int a, int b) const
+        {
+            const ScanSource &x = (*sources)[a], &y = (*sources)[b];
+            if (x.key != y.key)
+                return x.key > y.key;
+            if (x.seq != y.seq)
+                return x.seq < y.seq;
+            return a > b; // Ingested records share sequence 0, the newer source wins
+        }
+    };
+    priority_queue<int, vector<int>, HeapOrder> heap{HeapOrder{&sources}};
+};
+
+extern "C"{
+    struct kv_snapshot *SNAPSHOT()
+    {
+        kv_snapshot *snapshot = new kv_snapshot;
+        snapshot->seq = next_seq - 1;
+        snapshot->memtable = tree.getSortedShared();
+        snapshot->tables = all_tables();
+        return snapshot;
+    }
+
+    void RELEASE_SNAPSHOT(struct kv_snapshot *snapshot)
+    {
+        delete snapshot;
+    }
+
+    int GET_AT(struct kv_snapshot *snapshot, const char* key1, size_t key_len, struct kv_value *value)
+    {
+        string key = std::string(key1, key_len);
+        Lookup lookup;
+
+        auto it = lower_bound(snapshot->memtable.begin(), snapshot->memtable.end(), key, [](const shared_ptr<const Record> &r, const string &k)
+                              { return r->key < k; });
+        if (it != snapshot->memtable.end() && (*it)->key == key &&
+            lookup.add((*it)->type, shared_ptr<const char>(*it, (*it)->value.data()), (*it)->value.size(), value))
+        {
+            return lookup.found;
+        }
+
+        try
+        {
+            for (shared_ptr<SSTable> &table : snapshot->tables)
+            {
+                RecordRef ref;
+                shared_ptr<const char> data;
+                if (table->find(key, ref, data) && lookup.add(ref.type, std::move(data), ref.value_len, value))
+                {
+                    return lookup.found;
+                }
+            }
+        }
+        catch (const runtime_error &e)
+        {
+            cerr << e.what() << endl;
+            return KV_ERROR;
+        }
+        lookup.finish(value);
+        return lookup.found;
+    }
+
+    struct kv_iterator *SCAN(struct kv_snapshot *snapshot, const char* start1, size_t start_len)
+    {
+        string start = std::string(start1, start_len);
+        kv_iterator *it = new kv_iterator;
+        it->snapshot = snapshot;
+
+        // Sources are fixed before the heap takes pointers into the vector
+        it->sources.resize(snapshot->tables.size() + 1);
+        it->sources[0].records = &snapshot->memtable;
+        for (size_t i = 0; i < snapshot->tables.size(); i++)
+        {
+            it->sources[i + 1].table = snapshot->tables[i];
+        }
+        try
+        {
+            for (size_t i = 0; i < it->sources.size(); i++)
+            {
+                it->sources[i].seek(start);
+                if (it->sources[i].valid)
+                {
+                    it->heap.push(i);
+                }
+            }
+        }
+        catch (const runtime_error &e)
+        {
+            cerr << e.what() << endl;
+            it->failed = true;
+        }
+        return it;
+    }
+
+    int SCAN_NEXT(struct kv_iterator *it, const char **key, size_t *key_len, struct kv_value *value)
+    {
+        while (!it->failed && !it->heap.empty())
+        {
+            it->key = it->sources[it->heap.top()].key;
+            Lookup lookup;
+            bool decided = false;
+
+            // Every source holding this key is advanced, the newest records decide the value
+            try
+            {
+                while (!it->heap.empty() && it->sources[it->heap.top()].key == it->key)
+                {
+                    int idx = it->heap.top();
+                    it->heap.pop();
+                    ScanSource &source = it->sources[idx];
+                    if (!decided)
+                    {
+                        decided = lookup.add(source.type, source.value, source.value_len, value);
+                    }
+                    source.next();
+                    if (source.valid)
+                    {
+                        it->heap.push(idx);
+                    }
+                }
+            }
+            catch (const runtime_error &e)
+            {
+                cerr << e.what() << endl;
+                if (lookup.found == KV_FOUND)
+                {
+                    RELEASE_VALUE(value);
+                }
+                it->failed = true;
+                break;
+            }
+            if (!decided)
+            {
+                lookup.finish(value);
+            }
+
+            if (lookup.found == KV_FOUND)
+            {
+                *key = it->key.data();
+                *key_len = it->key.size();
+                return KV_FOUND;
+            }
+        }
+        return it->failed ? KV_ERROR : KV_NOT_FOUND;
+    }
+
+    void SCAN_CLOSE(struct kv_iterator *it)
+    {
+        delete it;
+    }
+}
+
+// Every record of a table, read with one sequential read of its data file
+Record *read_SSTable(SSTable &table)
+{
+    int data_size = table.get_num_keys();
+    auto *data = new Record[data_size];
+
+    // Compaction reads every block once, caching them would only evict hot ones.
+    // Every block is verified, a damaged input must not be merged into new tables.
+    string stored;
+    try
+    {
+        stored = table.read_data();
+    }
+    catch (const runtime_error &e)
+    {
+        delete[] data;
+        throw runtime_error(table.get_folder_name() + ": " + e.what());
+    }
+    int idx = 0; // Current index in the array
+    for (const BlockHandle &handle : table.get_blocks())
+    {
+        shared_ptr<const string> block = decodeStoredBlock(stored.data() + handle.offset, handle.size);
+        if (block == nullptr)
+        {
+            delete[] data;
+            throw runtime_error("Corrupt block " + table.block_key(handle));
+        }
+        BlockIter it;
+        it.init(block->data(), block->size());
+        while (idx < data_size && it.next())
+        {
+            data[idx++] = {it.key, block->substr(it.ref.value_pos, it.ref.value_len), it.ref.seq, it.ref.type};
+        }
+    }
+
+    return data;
+}
+
+// Combines two records of the same key, a merge operand on top folds into the older value.
+// Throws if that value is in the value log and cannot be read.
+Record combineRecords(const Record &newer, const Record &older)
+{
+    if (newer.type != RECORD_MERGE)
+    {
+        return newer;
+    }
+    Record result = newer;
+    if (older.type == RECORD_DELETE)
+    {
+        result.type = RECORD_PUT;
+    }
+    else if (older.type == RECORD_VALUE_REF)
+    {
+        // The result is a new value, the table built from it logs it again if it is large
+        shared_ptr<const string> stored = value_log.read(older.value.data(), older.value.size());
+        if (stored == nullptr)
+        {
+            throw runtime_error("unreadable value log entry of key " + older.key);
+        }
+        result.value = *stored + newer.value;
+        result.type = RECORD_PUT;
+    }
+    else
+    {
+        result.value = older.value + newer.value;
+        result.type = older.type;
+    }
+    return result;
+}
+
+// With bottom set nothing older than the inputs exists, so deletes are dropped
+// and merge operands become plain values. Shadowed records pointing into the
+// value log are added to garbage, to be discarded once the result is installed.
+pair<int, Record *> mergeSortedSSTables(const pair<int, Record *> &recent_sstable, const pair<int, Record *> &old_sstable, bool bottom, vector<Record> &garbage)
+{
+    int recent_size = recent_sstable.first;
+    int old_size = old_sstable.first;
+    Record *recent_array = recent_sstable.second;
+    Record *old_array = old_sstable.second;
+
+    int merged_size = recent_size + old_size;
+    Record *merged_array = new Record[merged_size];
+
+    int i = 0, j = 0, k = 0;
+
+    // An unreadable value log entry aborts the merge
+    try
+    {
+        while (i < recent_size && j < old_size)
+        {
+            if (recent_array[i].key < old_array[j].key)
+            {
+                merged_array[k++] = recent_array[i++];
+            }
+            else if (recent_array[i].key > old_array[j].key)
+            {
+                merged_array[k++] = old_array[j++];
+            }
+            else
+            {
+                // Sequence numbers, not table order, decide which write is newer. Only
+                // ingested records share one, then the newer table wins as in GET.
+                // Either way the older record's logged value is no longer needed.
+                const Record *shadowed;
+                if (recent_array[i].seq >= old_array[j].seq)
+                {
+                    merged_array[k++] = combineRecords(recent_array[i], old_array[j]);
+                    shadowed = &old_array[j];
+                }
+                else
+                {
+                    merged_array[k++] = combineRecords(old_array[j], recent_array[i]);
+                    shadowed = &recent_array[i];
+                }
+                if (shadowed->type == RECORD_VALUE_REF)
+                {
+                    garbage.push_back(*shadowed);
+                }
+                i++;
+                j++;
+            }
+        }
+    }
+    catch (const runtime_error &)
+    {
+        delete[] merged_array;
+        throw;
+    }
+
+    while (i < recent_size)
+    {
+        merged_array[k++] = recent_array[i++];
+    }
+
+    while (j < old_size)
+    {
+        merged_array[k++] = old_array[j++];
+    }
+
+    Record *resized_array = new Record[k];
+    int n = 0;
+    for (int idx = 0; idx < k; ++idx)
+    {
+        if (bottom && merged_array[idx].type == RECORD_DELETE)
+        {
+            continue;
+        }
+        resized_array[n] = std::move(merged_array[idx]);
+        if (bottom && resized_array[n].type == RECORD_MERGE)
+        {
+            resized_array[n].type = RECORD_PUT;
+        }
+        n++;
+    }
+    delete[] merged_array;
+
+    return {n, resized_array};
+}
+
+// Value log garbage collection: rewrites the tables pointing into the segment
+// with the most garbage, which appends its live values to the active segment.
+// Dead values are simply not copied. The segment file goes once the replaced
+// tables are released. Runs on the compaction thread, under mtx_compaction.
+// Returns false if no segment had enough garbage.
+bool collect_value_log()
+{
+    int64_t victim = value_log.gc_candidate();
+    if (victim < 0)
+    {
+        return false;
+    }
+    for (shared_ptr<SSTable> &table : all_tables())
+    {
+        if (!table->references_segment(victim))
+        {
+            continue;
+        }
+
+        int num_keys = table->get_num_keys();
+        io_limiter.request(table->get_data_size());
+        Record *records = read_SSTable(*table);
+        if (!value_log.inline_values(records, num_keys, victim))
+        {
+            delete[] records;
+            throw runtime_error("unreadable value log segment " + to_string(victim));
+        }
+        auto rewritten = make_shared<SSTable>(make_pair(num_keys, records), "", table->get_codec());
+        delete[] records;
+        if (!rewritten->is_built())
+        {
+            throw runtime_error("error writing table " + rewritten->get_folder_name());
+        }
+        io_limiter.request(rewritten->get_data_size());
+
+        // Same keys, so the table keeps its place in its level
+        lock_guard<mutex> lock(mtx_sstablelist);
+        for (vector<shared_ptr<SSTable>> &level : SSTable_levels)
+        {
+            replace(level.begin(), level.end(), table, rewritten);
+        }
+    }
+    value_log.mark_collected(victim);
+    return true;
+}
+
+// One compaction step: tables of one level merged with the tables of the next
+// level whose ranges they overlap, the output replaces both in the next level
+struct CompactionJob
+{
+    size_t level;
+    vector<shared_ptr<SSTable>> inputs;   // Newest first
+    vector<shared_ptr<SSTable>> overlaps; // In the next level, by first key
+    bool bottom = false;                  // No deeper level holds tables
+};
+
+// Per level, the last key of the table compacted out of it most recently.
+// Compaction takes the next table after it, so every part of a level gets its turn.
+vector<string> compact_cursor;
+
+// How far a level is over its size, compaction is due at 1. Level 0 counts
+// tables, as every one of them adds a read to lookups. Called with mtx_sstablelist held.
+double compaction_score(size_t level)
+{
+    if (level == 0)
+    {
+        return (double)SSTable_levels[0].size() / L0_COMPACTION_TRIGGER;
+    }
+    size_t keys = 0;
+    for (const shared_ptr<SSTable> &table : SSTable_levels[level])
+    {
+        keys += table->get_num_keys();
+    }
+    return (double)keys / level_max_keys(level);
+}
+
+// Whether some level is due for compaction, benchmarks wait for it to settle
+bool compaction_pending()
+{
+    lock_guard<mutex> lock(mtx_sstablelist);
+    for (size_t level = 0; level < SSTable_levels.size(); level++)
+    {
+        if (compaction_score(level) >= 1)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Picks the next compaction step from the level with the highest score: every
+// level 0 table, or one table of a deeper level. Called with mtx_sstablelist
+// held, false if no level is due.
+bool pick_compaction(CompactionJob &job)
+{
+    double best = 0;
+    for (size_t level = 0; level < SSTable_levels.size(); level++)
+    {
+        double score = compaction_score(level);
+        if (score > best)
+        {
+            best = score;
+            job.level = level;
+        }
+    }
+    if (best < 1)
+    {
+        return false;
+    }
+
+    if (job.level == 0)
+    {
+        job.inputs.assign(SSTable_levels[0].rbegin(), SSTable_levels[0].rend());
+    }
+    else
+    {
+        compact_cursor.resize(SSTable_levels.size());
+        const vector<shared_ptr<SSTable>> &tables = SSTable_levels[job.level];
+        auto it = upper_bound(tables.begin(), tables.end(), compact_cursor[job.level], [](const string &k, const shared_ptr<SSTable> &table)
+                              { return k < table->get_first_key(); });
+        job.inputs.push_back(it != tables.end() ? *it : tables.front());
+    }
+
+    if (SSTable_levels.size() == job.level + 1)
+    {
+        SSTable_levels.emplace_back();
+    }
+    string smallest = job.inputs[0]->get_first_key(), largest = job.inputs[0]->get_last_key();
+    for (const shared_ptr<SSTable> &table : job.inputs)
+    {
+        smallest = min(smallest, table->get_first_key());
+        largest = max(largest, table->get_last_key());
+    }
+    for (const shared_ptr<SSTable> &table : SSTable_levels[job.level + 1])
+    {
+        if (!(table->get_last_key() < smallest) && !(largest < table->get_first_key()))
+        {
+            job.overlaps.push_back(table);
+        }
+    }
+
+    // Merging into the deepest level that holds tables, no tombstone has anything left to hide
+    job.bottom = true;
+    for (size_t level = job.level + 2; level < SSTable_levels.size() && job.bottom; level++)
+    {
+        job.bottom = SSTable_levels[level].empty();
+    }
+    return true;
+}
+
+// Merges the job's inputs into the next level, in tables of LEVEL_TABLE_KEYS keys.
+// The replaced tables are deleted once in-flight reads release them.
+void run_compaction(CompactionJob &job)
+{
+    StageTimer timer(statistics, STAGE_COMPACTION);
+    vector<shared_ptr<SSTable>> outputs;
+    vector<Record> garbage; // Value log entries the outputs no longer point to
+    if (job.level > 0 && job.overlaps.empty())
+    {
+        // Nothing to merge with, the table moves down as it is
+        outputs = job.inputs;
+    }
+    else
+    {
+        // Every table is read, and verified, before anything is merged
+        vector<Record *> input_records, overlap_records;
+        try
+        {
+            for (const shared_ptr<SSTable> &table : job.inputs)
+            {
+                io_limiter.request(table->get_data_size());
+                input_records.push_back(read_SSTable(*table));
+                statistics.add(COMPACTION_BYTES_READ, table->get_data_size());
+            }
+            for (const shared_ptr<SSTable> &table : job.overlaps)
+            {
+                io_limiter.request(table->get_data_size());
+                overlap_records.push_back(read_SSTable(*table));
+                statistics.add(COMPACTION_BYTES_READ, table->get_data_size());
+            }
+        }
+        catch (const runtime_error &)
+        {
+            for (Record *records : input_records)
+                delete[] records;
+            for (Record *records : overlap_records)
+                delete[] records;
+            throw;
+        }
+
+        // Inputs fold in from the newest, then the result merges with the older next level
+        pair<int, Record *> merged = {0, new Record[0]};
+        size_t folded = 0;
+        try
+        {
+            for (; folded < job.inputs.size(); folded++)
+            {
+                pair<int, Record *> older = {job.inputs[folded]->get_num_keys(), input_records[folded]};
+                pair<int, Record *> next = mergeSortedSSTables(merged, older, false, garbage);
+                delete[] merged.second;
+                delete[] older.second;
+                merged = next;
+            }
+        }
+        catch (const runtime_error &)
+        {
+            delete[] merged.second;
+            for (size_t i = folded; i < input_records.size(); i++)
+                delete[] input_records[i];
+            for (Record *records : overlap_records)
+                delete[] records;
+            throw;
+        }
+
+        // The overlapping tables are disjoint and sorted, together one sorted array
+        int num_keys = 0;
+        for (const shared_ptr<SSTable> &table : job.overlaps)
+        {
+            num_keys += table->get_num_keys();
+        }
+        pair<int, Record *> older = {num_keys, new Record[num_keys]};
+        int n = 0;
+        for (size_t i = 0; i < job.overlaps.size(); i++)
+        {
+            Record *records = overlap_records[i];
+            std::move(records, records + job.overlaps[i]->get_num_keys(), older.second + n);
+            n += job.overlaps[i]->get_num_keys();
+            delete[] records;
+        }
+
+        pair<int, Record *> result;
+        try
+        {
+            result = mergeSortedSSTables(merged, older, job.bottom, garbage);
+        }
+        catch (const runtime_error &)
+        {
+            delete[] merged.second;
+            delete[] older.second;
+            throw;
+        }
+        delete[] merged.second;
+        delete[] older.second;
+
+        for (int start = 0; start < result.first; start += LEVEL_TABLE_KEYS)
+        {
+            int count = min(LEVEL_TABLE_KEYS, result.first - start);
+            outputs.push_back(make_shared<SSTable>(make_pair(count, result.second + start), "", job.bottom ? BOTTOM_CODEC : COMPACTION_CODEC));
+            if (!outputs.back()->is_built())
+            {
+                // The inputs stay, the outputs written so far are removed with outputs
+                delete[] result.second;
+                throw runtime_error("error writing table " + outputs.back()->get_folder_name());
+            }
+            io_limiter.request(outputs.back()->get_data_size());
+            statistics.add(COMPACTION_BYTES_WRITTEN, outputs.back()->get_data_size());
+        }
+        delete[] result.second;
+    }
+    statistics.add(COMPACTIONS);
+
+    lock_guard<mutex> lock(mtx_sstablelist);
+    auto remove_tables = [](vector<shared_ptr<SSTable>> &level, const vector<shared_ptr<SSTable>> &tables)
+    {
+        level.erase(remove_if(level.begin(), level.end(), [&](const shared_ptr<SSTable> &table)
+                              { return std::find(tables.begin(), tables.end(), table) != tables.end(); }),
+                    level.end());
+    };
+    remove_tables(SSTable_levels[job.level], job.inputs);
+    vector<shared_ptr<SSTable>> &next_level = SSTable_levels[job.level + 1];
+    remove_tables(next_level, job.overlaps);
+    next_level.insert(next_level.end(), outputs.begin(), outputs.end());
+    sort(next_level.begin(), next_level.end(), [](const shared_ptr<SSTable> &a, const shared_ptr<SSTable> &b)
+         { return a->get_first_key() < b->get_first_key(); });
+    if (job.level > 0)
+    {
+        compact_cursor[job.level] = job.inputs[0]->get_last_key();
+    }
+    update_write_pressure();
+
+    // Only now, a failed compaction is retried and would count them twice
+    for (const Record &record : garbage)
+    {
+        value_log.discard(record);
+    }
+}
+
+// Compaction thread: runs compaction steps while a level is due, then value log
+// collection, then sleeps until a flush or an ingest signals new work
+void compact()
+{
+    while (1)
+    {
+        CompactionJob job;
+        mtx_compaction.lock();
+        mtx_sstablelist.lock();
+        bool make_compact = pick_compaction(job);
+        mtx_sstablelist.unlock();
+        bool worked = make_compact;
+        try
+        {
+            if(make_compact)
+            {
+                run_compaction(job);
+                compaction_failed = false;
+            }
+            else
+            {
+                worked = collect_value_log();
+            }
+        }
+        catch (const runtime_error &e)
+        {
+            // Damaged inputs stay where they are, compaction retries on the next signal
+            cerr << "Compaction failed: " << e.what() << endl;
+            worked = false;
+            lock_guard<mutex> lock(mtx_sstablelist);
+            compaction_failed = true;
+            stall_cv.notify_all();
+        }
+        mtx_compaction.unlock();
+
+        if (!worked)
+        {
+            // A signal sent since the check above is not lost, the flag stays set
+            unique_lock<mutex> lock(mtx_compaction_signal);
+            compaction_cv.wait(lock, []
+                               { return compaction_signalled; });
+            compaction_signalled = false;
         }
-        usleep(comp_time);
     }
 }
 
 extern "C"{
+    int start_value_log()
+    {
+        return value_log.open(VLOG_DIR) ? 0 : -1;
+    }
+
     void start_compaction()
     {
 
         thread compaction_thread(compact);
         compaction_thread.detach();
     }
+
+    int INGEST(const char* path, size_t path_len)
+    {
+        return ingest_tables(std::string(path, path_len));
+    }
+
+    void STALL_STATS(struct kv_stall_stats *stats)
+    {
+        stats->delayed_writes = delayed_writes;
+        stats->stopped_writes = stopped_writes;
+        stats->stall_micros = stall_micros;
+    }
+}
+
+// Statistics as INFO text: the engine counters, the gauges kept by the caches,
+// write stalls and levels, then the latency histograms
+string stats_report()
+{
+    string text = "# Stats\r\n" + statistics.counters_text();
+    char line[256];
+    snprintf(line, sizeof(line),
+             "row_cache_hits:%llu\r\nrow_cache_misses:%llu\r\nstall_delayed_writes:%llu\r\n"
+             "stall_stopped_writes:%llu\r\nstall_micros:%llu\r\ncompaction_failed:%d\r\n",
+             (unsigned long long)row_cache.get_hits(), (unsigned long long)row_cache.get_misses(),
+             (unsigned long long)delayed_writes, (unsigned long long)stopped_writes,
+             (unsigned long long)stall_micros, (int)compaction_failed);
+    text += line;
+    {
+        lock_guard<mutex> lock(mtx_sstablelist);
+        for (size_t level = 0; level < SSTable_levels.size(); level++)
+        {
+            snprintf(line, sizeof(line), "level%zu_tables:%zu\r\n", level, SSTable_levels[level].size());
+            text += line;
+        }
+    }
+    return text + "# Latency\r\n" + statistics.latency_text();
+}
+
+// Statistics thread: logs the report every STATS_DUMP_INTERVAL seconds
+void dump_stats()
+{
+    while (1)
+    {
+        this_thread::sleep_for(chrono::seconds(STATS_DUMP_INTERVAL));
+        string text = stats_report();
+        text.erase(remove(text.begin(), text.end(), '\r'), text.end());
+        cerr << text << flush;
+    }
+}
+
+extern "C"{
+    int STATS_SAMPLE()
+    {
+        return statistics.sample_command();
+    }
+
+    void STATS_RECORD_COMMAND(int command, long long nanos)
+    {
+        statistics.record_command(command, nanos);
+    }
+
+    size_t STATS_INFO(char *buf, size_t size)
+    {
+        string text = stats_report();
+        if (size > 0)
+        {
+            size_t n = min(size - 1, text.size());
+            memcpy(buf, text.data(), n);
+            buf[n] = '\0';
+        }
+        return text.size();
+    }
+
+    void start_stats_dump()
+    {
+        if (STATS_DUMP_INTERVAL > 0)
+        {
+            thread dump_thread(dump_stats);
+            dump_thread.detach();
+        }
+    }
 }
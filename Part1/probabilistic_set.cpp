@@ -62,4 +62,32 @@ public:
         }
         return true; // Key might be in the set
     }
+
+    // Writes the bit vector packed 8 bits per byte
+    void save(ostream &out) const
+    {
+        string bytes((bitVector.size() + 7) / 8, '\0');
+        for (size_t i = 0; i < bitVector.size(); i++)
+        {
+            if (bitVector[i])
+            {
+                bytes[i / 8] |= 1 << (i % 8);
+            }
+        }
+        out.write(bytes.data(), bytes.size());
+    }
+
+    bool load(istream &in)
+    {
+        string bytes((bitVector.size() + 7) / 8, '\0');
+        if (!in.read(&bytes[0], bytes.size()))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < bitVector.size(); i++)
+        {
+            bitVector[i] = (bytes[i / 8] >> (i % 8)) & 1;
+        }
+        return true;
+    }
 };
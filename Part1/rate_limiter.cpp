@@ -0,0 +1,65 @@
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+
+// Token bucket pacing background I/O to a number of bytes per second. A request
+// larger than the bucket is let through and paid back by sleeping, so callers
+// may charge a whole table at once. High priority requests (flushes) never
+// wait, they only drain the bucket, so compaction behind them waits longer.
+// A rate of 0 never waits.
+class RateLimiter
+{
+private:
+    double rate;   // Bytes per second
+    double tokens; // Bytes that may go now, negative while paying back requests
+    chrono::steady_clock::time_point last_refill;
+    mutex mtx;
+
+    // Called with mtx held
+    void refill()
+    {
+        auto now = chrono::steady_clock::now();
+        // At most one second of burst builds up while idle
+        tokens = min(rate, tokens + rate * chrono::duration<double>(now - last_refill).count());
+        last_refill = now;
+    }
+
+public:
+    RateLimiter(size_t bytes_per_sec) : rate(bytes_per_sec), tokens(bytes_per_sec), last_refill(chrono::steady_clock::now()) {}
+
+    void request(size_t bytes, IOPriority priority = IO_LOW)
+    {
+        double wait;
+        {
+            lock_guard<mutex> lock(mtx);
+            if (rate <= 0)
+            {
+                return;
+            }
+            refill();
+            tokens -= bytes;
+            wait = tokens < 0 && priority == IO_LOW ? -tokens / rate : 0;
+        }
+        if (wait > 0)
+        {
+            this_thread::sleep_for(chrono::duration<double>(wait));
+        }
+    }
+
+    // Changes the rate from now on, what was granted so far stays paid for
+    void set_rate(size_t bytes_per_sec)
+    {
+        lock_guard<mutex> lock(mtx);
+        refill();
+        rate = bytes_per_sec;
+    }
+
+    size_t get_rate()
+    {
+        lock_guard<mutex> lock(mtx);
+        return rate;
+    }
+};
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "resp.h"
+
+void resp_parser_init(struct resp_parser *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->argc = -1;
+}
+
+void resp_parser_free(struct resp_parser *p)
+{
+    free(p->offsets);
+    free(p->lengths);
+    free(p->argv);
+    resp_parser_init(p);
+}
+
+static int reserve(struct resp_parser *p, size_t n)
+{
+    if (n <= p->cap)
+    {
+        return 1;
+    }
+    size_t cap = p->cap ? p->cap : 8;
+    while (cap < n)
+        cap *= 2;
+
+    size_t *offsets = (size_t *)realloc(p->offsets, cap * sizeof(size_t));
+    if (offsets == NULL)
+        return 0;
+    p->offsets = offsets;
+    size_t *lengths = (size_t *)realloc(p->lengths, cap * sizeof(size_t));
+    if (lengths == NULL)
+        return 0;
+    p->lengths = lengths;
+    struct resp_arg *argv = (struct resp_arg *)realloc(p->argv, cap * sizeof(struct resp_arg));
+    if (argv == NULL)
+        return 0;
+    p->argv = argv;
+
+    p->cap = cap;
+    return 1;
+}
+
+// Finds the CRLF ending the line at pos, returns its offset or -1
+static long find_crlf(const char *buf, size_t len, size_t pos)
+{
+    while (pos < len)
+    {
+        const char *cr = (const char *)memchr(buf + pos, '\r', len - pos);
+        if (cr == NULL)
+        {
+            return -1;
+        }
+        size_t at = cr - buf;
+        if (at + 1 >= len)
+        {
+            return -1;
+        }
+        if (buf[at + 1] == '\n')
+        {
+            return (long)at;
+        }
+        pos = at + 1;
+    }
+    return -1;
+}
+
+// Parses the signed decimal in [start, end)
+static int parse_long(const char *start, const char *end, long *out)
+{
+    int neg = 0;
+    long value = 0;
+
+    if (start < end && *start == '-')
+    {
+        neg = 1;
+        start++;
+    }
+    if (start == end)
+    {
+        return 0;
+    }
+    for (; start < end; start++)
+    {
+        if (*start < '0' || *start > '9' || value > RESP_MAX_BULK)
+        {
+            return 0;
+        }
+        value = value * 10 + (*start - '0');
+    }
+    *out = neg ? -value : value;
+    return 1;
+}
+
+static void finish(struct resp_parser *p, const char *buf, size_t *consumed)
+{
+    for (long i = 0; i < p->argc; i++)
+    {
+        p->argv[i].ptr = buf + p->offsets[i];
+        p->argv[i].len = p->lengths[i];
+    }
+    *consumed = p->pos;
+    p->pos = 0;
+    p->argi = 0;
+}
+
+// Space separated command terminated by a newline, as typed into telnet
+static int parse_inline(struct resp_parser *p, const char *buf, size_t len, size_t *consumed)
+{
+    const char *nl = (const char *)memchr(buf, '\n', len);
+    if (nl == NULL)
+    {
+        return len > RESP_MAX_INLINE ? RESP_ERROR : RESP_INCOMPLETE;
+    }
+
+    size_t end = nl - buf;
+    size_t line_end = (end > 0 && buf[end - 1] == '\r') ? end - 1 : end;
+    long argc = 0;
+
+    for (size_t i = 0; i < line_end;)
+    {
+        while (i < line_end && buf[i] == ' ')
+            i++;
+        if (i == line_end)
+            break;
+        size_t start = i;
+        while (i < line_end && buf[i] != ' ')
+            i++;
+
+        if (!reserve(p, argc + 1))
+            return RESP_ERROR;
+        p->offsets[argc] = start;
+        p->lengths[argc] = i - start;
+        argc++;
+    }
+
+    p->argc = argc;
+    p->pos = end + 1;
+    finish(p, buf, consumed);
+    return RESP_OK;
+}
+
+int resp_parse(struct resp_parser *p, const char *buf, size_t len, size_t *consumed)
+{
+    if (p->pos == 0)
+    {
+        // A new command, argc from the previous one is stale
+        p->argc = -1;
+        p->argi = 0;
+    }
+    if (len == 0)
+    {
+        return RESP_INCOMPLETE;
+    }
+
+    if (p->argc < 0)
+    {
+        if (buf[0] != '*')
+        {
+            return parse_inline(p, buf, len, consumed);
+        }
+
+        long crlf = find_crlf(buf, len, 0);
+        if (crlf < 0)
+        {
+            return len > RESP_MAX_INLINE ? RESP_ERROR : RESP_INCOMPLETE;
+        }
+
+        long argc;
+        if (!parse_long(buf + 1, buf + crlf, &argc) || argc > RESP_MAX_ARGS)
+        {
+            return RESP_ERROR;
+        }
+        if (argc < 0)
+        {
+            // Null array, nothing to execute
+            argc = 0;
+        }
+        p->argc = argc;
+        p->pos = crlf + 2;
+    }
+
+    // Each element is a length-prefixed bulk string, or a RESP3 simple string/number
+    while (p->argi < p->argc)
+    {
+        if (p->pos >= len)
+        {
+            return RESP_INCOMPLETE;
+        }
+
+        char type = buf[p->pos];
+        long crlf = find_crlf(buf, len, p->pos);
+        if (crlf < 0)
+        {
+            return len - p->pos > RESP_MAX_INLINE ? RESP_ERROR : RESP_INCOMPLETE;
+        }
+        // Grown as elements arrive, not by the header's count, which costs the sender nothing
+        if (!reserve(p, p->argi + 1))
+        {
+            return RESP_ERROR;
+        }
+
+        if (type == '+' || type == ':')
+        {
+            p->offsets[p->argi] = p->pos + 1;
+            p->lengths[p->argi] = crlf - p->pos - 1;
+            p->argi++;
+            p->pos = crlf + 2;
+            continue;
+        }
+        if (type != '$')
+        {
+            return RESP_ERROR;
+        }
+
+        long bulk_len;
+        if (!parse_long(buf + p->pos + 1, buf + crlf, &bulk_len) || bulk_len < 0 || bulk_len > RESP_MAX_BULK)
+        {
+            return RESP_ERROR;
+        }
+
+        // The payload is taken by length, it may contain CR, LF or NUL bytes
+        size_t data = crlf + 2;
+        if (len < data + bulk_len + 2)
+        {
+            return RESP_INCOMPLETE;
+        }
+        if (buf[data + bulk_len] != '\r' || buf[data + bulk_len + 1] != '\n')
+        {
+            return RESP_ERROR;
+        }
+
+        p->offsets[p->argi] = data;
+        p->lengths[p->argi] = bulk_len;
+        p->argi++;
+        p->pos = data + bulk_len + 2;
+    }
+
+    finish(p, buf, consumed);
+    return RESP_OK;
+}
+
+int resp_arg_is(const struct resp_arg *arg, const char *name)
+{
+    size_t len = strlen(name);
+    return arg->len == len && strncasecmp(arg->ptr, name, len) == 0;
+}
@@ -0,0 +1,58 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define RESP_OK 1
+#define RESP_INCOMPLETE 0
+#define RESP_ERROR -1
+
+#define RESP_MAX_ARGS (1024 * 1024)
+#define RESP_MAX_BULK (512L * 1024 * 1024)
+#define RESP_MAX_INLINE (64 * 1024)
+
+// A view into the receive buffer, not NUL terminated
+struct resp_arg
+{
+    const char *ptr;
+    size_t len;
+};
+
+// Incremental request parser, state survives across partial reads.
+// Positions are kept as offsets so the caller may grow or move its buffer
+// between calls as long as the unconsumed bytes keep their order.
+struct resp_parser
+{
+    size_t pos;  // Bytes of the current command already parsed
+    long argc;   // Elements announced by the array header, -1 before it is read
+    long argi;   // Elements parsed so far
+    size_t *offsets;
+    size_t *lengths;
+    size_t cap;
+
+    // Valid after resp_parse returns RESP_OK, until the next call
+    struct resp_arg *argv;
+};
+
+void resp_parser_init(struct resp_parser *p);
+void resp_parser_free(struct resp_parser *p);
+
+// Parses one command from buf, which must start at the first unconsumed byte.
+// RESP_OK: p->argc/p->argv hold the command and *consumed bytes can be dropped.
+// RESP_INCOMPLETE: call again with the same bytes plus more data.
+// RESP_ERROR: malformed input, the connection should be closed.
+int resp_parse(struct resp_parser *p, const char *buf, size_t len, size_t *consumed);
+
+// Case-insensitive comparison of an argument with a command name
+int resp_arg_is(const struct resp_arg *arg, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RESP_H
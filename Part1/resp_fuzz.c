@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resp.h"
+
+// Checks the RESP request parser against a corpus and random mutations of it.
+// Every input is parsed whole, split in two at every position, and fed one
+// byte at a time; all three must yield the same commands and end the same
+// way. Every parsed argument must lie inside the consumed bytes, and the
+// parser must not allocate for elements it has not seen. Files named ok_*,
+// incomplete_* and error_* must also end that way when parsed whole.
+// Usage: ./resp_fuzz [-m mutations] file...  (make fuzz runs it under ASan and UBSan)
+
+// How a run over a whole input ended
+enum ending
+{
+    END_CONSUMED = 'K',   // Every byte went into a command
+    END_INCOMPLETE = 'I', // A partial command is left
+    END_ERROR = 'E'
+};
+
+// Commands a run produced, serialized, and how it ended
+struct outcome
+{
+    char *text;
+    size_t len;
+    size_t cap;
+    int ending;
+};
+
+static const char *current; // Name of the input being checked, for failure messages
+static long failures = 0;
+
+static void fail(const char *what, size_t first, size_t step)
+{
+    if (failures++ < 20)
+    {
+        fprintf(stderr, "%s: %s (first %zu, step %zu)\n", current, what, first, step);
+    }
+}
+
+static void append(struct outcome *o, const void *data, size_t len)
+{
+    if (o->cap - o->len < len)
+    {
+        while (o->cap - o->len < len)
+            o->cap = o->cap ? o->cap * 2 : 256;
+        o->text = (char *)realloc(o->text, o->cap);
+    }
+    memcpy(o->text + o->len, data, len);
+    o->len += len;
+}
+
+// Parses buf, first offering its first bytes and then step more per call until
+// all of it is available, as reads from a socket would
+static void parse_all(const char *buf, size_t len, size_t first, size_t step, struct outcome *o)
+{
+    struct resp_parser parser;
+    resp_parser_init(&parser);
+    o->len = 0;
+
+    size_t off = 0, avail = first < len ? first : len;
+    while (1)
+    {
+        size_t consumed = 0;
+        int ret = resp_parse(&parser, buf + off, avail - off, &consumed);
+        if (parser.cap > 8 + 2 * avail)
+        {
+            fail("parser allocated for elements it has not seen", first, step);
+        }
+        if (ret == RESP_ERROR)
+        {
+            o->ending = END_ERROR;
+            break;
+        }
+        if (ret == RESP_INCOMPLETE)
+        {
+            if (avail == len)
+            {
+                o->ending = off == len ? END_CONSUMED : END_INCOMPLETE;
+                break;
+            }
+            avail = avail + step < len ? avail + step : len;
+            continue;
+        }
+
+        if (consumed == 0 || consumed > avail - off)
+        {
+            fail("bad consumed count", first, step);
+            o->ending = END_ERROR;
+            break;
+        }
+        append(o, &parser.argc, sizeof(parser.argc));
+        for (long i = 0; i < parser.argc; i++)
+        {
+            const struct resp_arg *arg = &parser.argv[i];
+            if (arg->ptr < buf + off || arg->ptr + arg->len > buf + off + consumed)
+            {
+                fail("argument outside the consumed bytes", first, step);
+                continue;
+            }
+            append(o, &arg->len, sizeof(arg->len));
+            append(o, arg->ptr, arg->len);
+        }
+        off += consumed;
+    }
+    resp_parser_free(&parser);
+}
+
+static int same_outcome(const struct outcome *a, const struct outcome *b)
+{
+    return a->ending == b->ending && a->len == b->len && (a->len == 0 || memcmp(a->text, b->text, a->len) == 0);
+}
+
+// Parses input whole, split at every position and byte by byte. Returns how the whole parse ended.
+static int check_input(const char *buf, size_t len)
+{
+    struct outcome whole = {0}, other = {0};
+    parse_all(buf, len, len, len, &whole);
+
+    for (size_t split = 0; split <= len; split++)
+    {
+        parse_all(buf, len, split, len, &other);
+        if (!same_outcome(&other, &whole))
+        {
+            fail("split parse differs from whole parse", split, len);
+        }
+    }
+    parse_all(buf, len, 0, 1, &other);
+    if (!same_outcome(&other, &whole))
+    {
+        fail("byte by byte parse differs from whole parse", 0, 1);
+    }
+
+    free(whole.text);
+    free(other.text);
+    return whole.ending;
+}
+
+static int expected_ending(const char *path)
+{
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if (strncmp(name, "ok_", 3) == 0)
+        return END_CONSUMED;
+    if (strncmp(name, "incomplete_", 11) == 0)
+        return END_INCOMPLETE;
+    if (strncmp(name, "error_", 6) == 0)
+        return END_ERROR;
+    return 0;
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = (char *)malloc(size > 0 ? size : 1);
+    *len = fread(buf, 1, size, f);
+    fclose(f);
+    return buf;
+}
+
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long long rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Changes one thing about the input: a byte replaced, inserted or removed, or
+// a range repeated. Replacement bytes favour the ones RESP gives meaning to.
+static size_t mutate(char *buf, size_t len, size_t cap)
+{
+    static const char interesting[] = "*$+:-\r\n0123456789";
+    char byte = rng() % 2 ? interesting[rng() % (sizeof(interesting) - 1)] : (char)rng();
+    size_t at = len ? rng() % len : 0;
+    switch (rng() % 4)
+    {
+    case 0:
+        if (len > 0)
+            buf[at] = byte;
+        return len;
+    case 1:
+        if (len < cap)
+        {
+            memmove(buf + at + 1, buf + at, len - at);
+            buf[at] = byte;
+            return len + 1;
+        }
+        return len;
+    case 2:
+        if (len > 0)
+        {
+            memmove(buf + at, buf + at + 1, len - at - 1);
+            return len - 1;
+        }
+        return len;
+    default:
+    {
+        size_t n = len - at < 16 ? len - at : 16;
+        if (len + n <= cap)
+        {
+            memmove(buf + at + n, buf + at, len - at);
+            return len + n;
+        }
+        return len;
+    }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long mutations = 200;
+    int first_file = 1;
+    if (argc > 2 && strcmp(argv[1], "-m") == 0)
+    {
+        mutations = atol(argv[2]);
+        first_file = 3;
+    }
+    if (first_file >= argc)
+    {
+        fprintf(stderr, "Usage: %s [-m mutations] file...\n", argv[0]);
+        return 1;
+    }
+
+    long inputs = 0;
+    for (int i = first_file; i < argc; i++)
+    {
+        size_t len;
+        char *seed = read_file(argv[i], &len);
+        if (seed == NULL)
+        {
+            fprintf(stderr, "Cannot read %s\n", argv[i]);
+            return 1;
+        }
+        current = argv[i];
+        int ending = check_input(seed, len);
+        int expected = expected_ending(argv[i]);
+        if (expected && ending != expected)
+        {
+            fprintf(stderr, "%s: ended %c, expected %c\n", argv[i], ending, expected);
+            failures++;
+        }
+        inputs++;
+
+        // Mutations pile up on one copy, so later ones stray further from the seed
+        size_t cap = len + 256;
+        char *buf = (char *)malloc(cap);
+        memcpy(buf, seed, len);
+        size_t buf_len = len;
+        for (long m = 0; m < mutations; m++)
+        {
+            if (m % 16 == 0)
+            {
+                memcpy(buf, seed, len);
+                buf_len = len;
+            }
+            buf_len = mutate(buf, buf_len, cap);
+            check_input(buf, buf_len);
+            inputs++;
+        }
+        free(buf);
+        free(seed);
+    }
+
+    printf("%ld inputs checked, %ld failures\n", inputs, failures);
+    return failures > 0;
+}
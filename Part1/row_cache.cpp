@@ -0,0 +1,227 @@
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+using namespace std;
+
+// Approximate access counts for TinyLFU admission: a count-min sketch of
+// saturating counters, all halved once the samples reach ten per counter so
+// old popularity fades.
+class FrequencySketch
+{
+private:
+    vector<uint8_t> counters;
+    size_t mask = 0;
+    size_t samples = 0;
+
+    size_t slot(size_t hash, int row) const
+    {
+        return (hash + row * ((hash >> 32) | 1)) & mask;
+    }
+
+public:
+    void resize(size_t width)
+    {
+        size_t size = 64;
+        while (size < width)
+        {
+            size <<= 1;
+        }
+        counters.assign(size, 0);
+        mask = size - 1;
+        samples = 0;
+    }
+
+    void increment(size_t hash)
+    {
+        for (int row = 0; row < 4; row++)
+        {
+            uint8_t &counter = counters[slot(hash, row)];
+            if (counter < 15)
+            {
+                counter++;
+            }
+        }
+        if (++samples >= counters.size() * 10)
+        {
+            for (uint8_t &counter : counters)
+            {
+                counter >>= 1;
+            }
+            samples /= 2;
+        }
+    }
+
+    int estimate(size_t hash) const
+    {
+        int count = 15;
+        for (int row = 0; row < 4; row++)
+        {
+            count = min<int>(count, counters[slot(hash, row)]);
+        }
+        return count;
+    }
+};
+
+// Results of point lookups that went to the tables, keyed by user key: the
+// value, or nullptr for a key no table holds. Only lookups the memtable did
+// not answer use it, so a key is invalidated when it is written. Each shard
+// counts its writes, and a fill started before a write to the shard is
+// dropped, so a lookup racing a write never caches the older result. A full
+// shard admits a key only if the sketch has seen it more often than the
+// entry it would evict.
+class RowCache
+{
+private:
+    struct Entry
+    {
+        string key;
+        shared_ptr<const string> value;
+        size_t hash;
+        size_t charge;
+    };
+
+    struct Shard
+    {
+        list<Entry> lru; // Most recently used first
+        unordered_map<string, list<Entry>::iterator> index;
+        FrequencySketch sketch;
+        size_t capacity = 0;
+        size_t usage = 0;
+        uint64_t write_seq = 0;
+        mutex mtx;
+    };
+
+    static const int SHARDS = 16;
+    static const size_t ENTRY_OVERHEAD = 96; // List node, map node and the key's allocation
+    Shard shards[SHARDS];
+    atomic<uint64_t> hits{0}, misses{0};
+
+    Shard &shard_of(size_t hash)
+    {
+        return shards[(hash >> 7) % SHARDS];
+    }
+
+    void erase(Shard &shard, unordered_map<string, list<Entry>::iterator>::iterator it)
+    {
+        shard.usage -= it->second->charge;
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+
+public:
+    RowCache(size_t capacity_bytes)
+    {
+        set_capacity(capacity_bytes);
+    }
+
+    // Empties the cache and gives it a new budget, 0 turns it off
+    void set_capacity(size_t capacity_bytes)
+    {
+        for (Shard &shard : shards)
+        {
+            lock_guard<mutex> lock(shard.mtx);
+            shard.lru.clear();
+            shard.index.clear();
+            shard.usage = 0;
+            shard.write_seq++;
+            shard.capacity = capacity_bytes / SHARDS;
+            shard.sketch.resize(capacity_bytes == 0 ? 0 : shard.capacity / ENTRY_OVERHEAD);
+        }
+        hits = 0;
+        misses = 0;
+    }
+
+    bool enabled()
+    {
+        return shards[0].capacity > 0;
+    }
+
+    // Looks key up and counts the access. On a hit value is the cached value,
+    // nullptr if the key is known to be absent. On a miss the returned
+    // sequence number is passed to insert along with the result.
+    bool lookup(const string &key, shared_ptr<const string> &value, uint64_t &fill_seq)
+    {
+        size_t hash = std::hash<string>{}(key);
+        Shard &shard = shard_of(hash);
+        lock_guard<mutex> lock(shard.mtx);
+        shard.sketch.increment(hash);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end())
+        {
+            fill_seq = shard.write_seq;
+            misses++;
+            return false;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        value = it->second->value;
+        hits++;
+        return true;
+    }
+
+    void insert(const string &key, shared_ptr<const string> value, uint64_t fill_seq)
+    {
+        size_t hash = std::hash<string>{}(key);
+        Shard &shard = shard_of(hash);
+        size_t charge = ENTRY_OVERHEAD + key.size() + (value ? value->size() : 0);
+        lock_guard<mutex> lock(shard.mtx);
+        if (shard.write_seq != fill_seq || charge > shard.capacity || shard.index.count(key))
+        {
+            return;
+        }
+        if (shard.usage + charge > shard.capacity &&
+            shard.sketch.estimate(hash) <= shard.sketch.estimate(shard.lru.back().hash))
+        {
+            return;
+        }
+        while (shard.usage + charge > shard.capacity)
+        {
+            erase(shard, shard.index.find(shard.lru.back().key));
+        }
+        shard.lru.push_front({key, std::move(value), hash, charge});
+        shard.index[key] = shard.lru.begin();
+        shard.usage += charge;
+    }
+
+    // Called after key was written to the memtable
+    void invalidate(const string &key)
+    {
+        Shard &shard = shard_of(std::hash<string>{}(key));
+        lock_guard<mutex> lock(shard.mtx);
+        shard.write_seq++;
+        auto it = shard.index.find(key);
+        if (it != shard.index.end())
+        {
+            erase(shard, it);
+        }
+    }
+
+    // Drops every entry, for changes that are not writes of single keys
+    void clear()
+    {
+        for (Shard &shard : shards)
+        {
+            lock_guard<mutex> lock(shard.mtx);
+            shard.lru.clear();
+            shard.index.clear();
+            shard.usage = 0;
+            shard.write_seq++;
+        }
+    }
+
+    uint64_t get_hits()
+    {
+        return hits;
+    }
+
+    uint64_t get_misses()
+    {
+        return misses;
+    }
+};
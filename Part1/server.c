@@ -8,46 +8,189 @@
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <stdint.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <time.h>
+
+#include "uring.h"
+#include "resp.h"
+#include "kv.h"
 
 #define MAXLINE 1024
 #define PORT 6379
 #define MAX_CLIENTS 10000
+#define MAX_EVENTS 1024
+
+// io_uring front-end sizing
+#define URING_ENTRIES 4096
+#define URING_BUF_COUNT 4096 // Must be a power of two
+#define URING_BUF_SIZE 4096
+#define URING_BUF_GROUP 0
+
+// Bulk values at least this large are sent straight from engine memory instead of copied
+#define ZERO_COPY_THRESHOLD 16384
+
+// Keys returned per SCAN call unless COUNT is given
+#define SCAN_DEFAULT_COUNT 10
+
+// A client with more reply bytes than this waiting to be sent is not read from until they drain
+#define OUTPUT_BACKLOG_LIMIT (1 << 20)
+
+// What the select and epoll backends watch a client for
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+
 fd_set master_fds;
+fd_set master_write_fds; // Clients whose replies wait for the socket to drain (select only)
+
+enum backend_type
+{
+    BACKEND_SELECT,
+    BACKEND_EPOLL,
+    BACKEND_URING
+};
 
-extern void start_compaction();
-extern void SET(char *, char *);
-extern void DEL(char *);
-extern const char *GET(char *);
+enum backend_type backend = BACKEND_SELECT;
+int epoll_fd = -1;
+struct uring *server_ring = NULL;
+int io_fd = -1; // Signalled by the engine when async block reads complete
+int blind_delete = 0; // DEL writes tombstones without checking the keys exist
 
-ssize_t send_message(int sockfd, const char *message, size_t length)
+// A large value sent from engine memory, it goes out after buf[0, offset)
+struct output_value
 {
-    ssize_t total_sent = 0; // Total bytes sent so far
-    ssize_t bytes_sent;
+    size_t offset;
+    struct kv_value value;
+};
 
-    while (total_sent < length)
+// Growable reply buffer, kept for the life of the connection
+struct output
+{
+    char *buf;
+    size_t len;
+    size_t cap;
+    struct output_value *values; // Pinned until the reply is sent
+    int nvalues;
+    int values_cap;
+    size_t value_bytes; // Length of the pinned values together
+};
+
+// Per-connection state, indexed by fd
+struct client
+{
+    unsigned gen; // Bumped on close so late completions for a reused fd are dropped
+    int pending;  // A GET is waiting on a disk read, the client is not served until it finishes
+    long long pending_start; // When the pending GET was dispatched if it is timed, else -1
+    int closing;  // Shut down once the queued replies are sent (uring only)
+    int eof;      // Receive side finished while a send was in flight (uring only)
+
+    // Received bytes not yet executed, grows to fit bulk strings of any size
+    char *in;
+    size_t in_len;
+    size_t in_cap;
+    struct resp_parser parser;
+
+    // Replies not yet written. New replies go to out while sending is in
+    // flight, the two are swapped when the send completes. The uring backend
+    // has the kernel send, select and epoll send until the socket is full and
+    // continue once it is writable.
+    struct output out;
+    struct output sending;
+    int send_in_flight;
+    int watched; // WATCH_* bits the select or epoll backend currently watches the socket for
+
+    // Gather list of the send in flight, iov[iov_idx..iov_cnt) is still unsent
+    struct iovec *iov;
+    int iov_cnt;
+    int iov_idx;
+    int iov_cap;
+    struct msghdr msg;
+
+    // SCAN in progress, every call continues on the same snapshot
+    unsigned long scan_cursor;
+    struct kv_snapshot *scan_snapshot;
+    struct kv_iterator *scan_it;
+
+    // Between MULTI and EXEC: the queued commands, re-encoded as RESP
+    int in_multi;
+    int multi_failed; // A command was rejected, EXEC discards the transaction
+    long multi_count;
+    struct output multi;
+};
+
+static const char REPLY_OK[] = "+OK\r\n";
+static const char REPLY_QUEUED[] = "+QUEUED\r\n";
+static const char REPLY_NIL[] = "$-1\r\n";
+static const char CRLF[] = "\r\n";
+
+struct client *clients = NULL;
+int clients_cap = 0;
+unsigned long next_scan_cursor = 1;
+
+struct client *get_client(int fd)
+{
+    if (fd >= clients_cap)
     {
-        bytes_sent = send(sockfd, message + total_sent, length - total_sent, 0);
-        if (bytes_sent < 0)
-        {
-            perror("Send failed");
-            return -1;
-        }
-        total_sent += bytes_sent;
+        int cap = clients_cap ? clients_cap : 1024;
+        while (cap <= fd)
+            cap *= 2;
+        clients = (struct client *)realloc(clients, cap * sizeof(struct client));
+        memset(clients + clients_cap, 0, (cap - clients_cap) * sizeof(struct client));
+        clients_cap = cap;
     }
+    return &clients[fd];
+}
+
+#define CLIENT_CTX(fd, gen) ((void *)(uintptr_t)(((uint64_t)(gen) << 32) | (uint32_t)(fd)))
+#define CTX_FD(ctx) ((int)((uintptr_t)(ctx) & 0xffffffff))
+#define CTX_GEN(ctx) ((unsigned)((uintptr_t)(ctx) >> 32))
 
-    return total_sent;
+// Drops n sent bytes from the front of an iovec array, possibly stopping inside an iovec
+void advance_iov(struct iovec **iov, int *iovcnt, size_t n)
+{
+    while (*iovcnt > 0 && n >= (*iov)->iov_len)
+    {
+        n -= (*iov)->iov_len;
+        (*iov)++;
+        (*iovcnt)--;
+    }
+    if (*iovcnt > 0)
+    {
+        (*iov)->iov_base = (char *)(*iov)->iov_base + n;
+        (*iov)->iov_len -= n;
+    }
+}
+
+// Make room for n more bytes of input
+void reserve_input(struct client *c, size_t n)
+{
+    if (c->in_cap - c->in_len >= n)
+    {
+        return;
+    }
+    size_t cap = c->in_cap ? c->in_cap : MAXLINE;
+    while (cap - c->in_len < n)
+    {
+        cap *= 2;
+    }
+    c->in = (char *)realloc(c->in, cap);
+    c->in_cap = cap;
 }
 
-ssize_t receive_message(int sockfd, char *buffer, size_t buffer_size)
+// Appends everything readable to the client's input buffer, returns -1 once the peer closed
+ssize_t receive_message(int sockfd, struct client *c)
 {
     ssize_t total_received = 0; // Total bytes received so far
     ssize_t bytes_received;
 
-    while (total_received < buffer_size - 1)
+    while (1)
     {
-        bytes_received = recv(sockfd, buffer + total_received, buffer_size - 1 - total_received, 0);
+        reserve_input(c, MAXLINE);
+        bytes_received = recv(sockfd, c->in + c->in_len, c->in_cap - c->in_len, 0);
         if (bytes_received < 0)
         {
             break;
@@ -55,13 +198,12 @@ ssize_t receive_message(int sockfd, char *buffer, size_t buffer_size)
         if (bytes_received == 0)
         {
             // Connection closed by the peer
-            FD_CLR(sockfd, &master_fds);
-            break;
+            return -1;
         }
+        c->in_len += bytes_received;
         total_received += bytes_received;
     }
 
-    buffer[total_received] = '\0'; // Null-terminate the buffer
     return total_received;
 }
 
@@ -84,196 +226,953 @@ ssize_t receive_message(int sockfd, char *buffer, size_t buffer_size)
 //     }
 // }
 
-// Parse the RESP2 protocol
-int parse_resp(char *message, char **command, char **arg1, char **arg2)
+// Make room for n more bytes of output
+void reserve_output(struct output *o, size_t n)
 {
-    if (message[0] == '*')
+    if (o->cap - o->len >= n)
+    {
+        return;
+    }
+    size_t cap = o->cap ? o->cap : MAXLINE;
+    while (cap - o->len < n)
     {
-        // Split the message by "\r\n"
-        char *token = strtok(message, "\r\n");
+        cap *= 2;
+    }
+    o->buf = (char *)realloc(o->buf, cap);
+    o->cap = cap;
+}
 
-        // Ensure the message is correctly formatted and has enough parts
-        if (token == NULL)
-            return 0;
+// Append raw RESP bytes to the client's reply buffer
+void reply_raw(int client_fd, const char *data, size_t len)
+{
+    struct output *o = &get_client(client_fd)->out;
+    reserve_output(o, len);
+    memcpy(o->buf + o->len, data, len);
+    o->len += len;
+}
 
-        // Skip the '*' marker
-        token = strtok(NULL, "\r\n");
-        if (token == NULL)
-            return 0;
+void reply_error(int client_fd, const char *message)
+{
+    reply_raw(client_fd, "-ERR ", 5);
+    reply_raw(client_fd, message, strlen(message));
+    reply_raw(client_fd, CRLF, 2);
+}
+
+// Formats a `<type><n>\r\n` line such as a bulk string header, returns its length
+size_t format_number(char *dst, char type, size_t n)
+{
+    char digits[24];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+
+    size_t pos = 0;
+    dst[pos++] = type;
+    while (count > 0)
+        dst[pos++] = digits[--count];
+    dst[pos++] = '\r';
+    dst[pos++] = '\n';
+    return pos;
+}
+
+void reply_integer(int client_fd, size_t n)
+{
+    char buf[32];
+    reply_raw(client_fd, buf, format_number(buf, ':', n));
+}
+
+// Reply with a value read from the engine, taking over its pin
+void reply_value(int client_fd, struct kv_value *value)
+{
+    char header[32];
+    size_t header_len = format_number(header, '$', value->len);
+    reply_raw(client_fd, header, header_len);
+
+    if (value->len < ZERO_COPY_THRESHOLD)
+    {
+        reply_raw(client_fd, value->data, value->len);
+        reply_raw(client_fd, CRLF, 2);
+        RELEASE_VALUE(value);
+        return;
+    }
 
-        // Get the command (SET/GET/DEL or other commands)
-        *command = strtok(NULL, "\r\n");
-        if (*command == NULL)
+    // Large value: referenced from the send's gather list, released once it is sent
+    struct output *o = &get_client(client_fd)->out;
+    if (o->nvalues == o->values_cap)
+    {
+        o->values_cap = o->values_cap ? o->values_cap * 2 : 8;
+        o->values = (struct output_value *)realloc(o->values, o->values_cap * sizeof(struct output_value));
+    }
+    o->values[o->nvalues].offset = o->len;
+    o->values[o->nvalues].value = *value;
+    o->nvalues++;
+    o->value_bytes += value->len;
+    reply_raw(client_fd, CRLF, 2);
+}
+
+// Gather list for the whole output, buffered bytes interleaved with pinned values
+int output_iov(struct client *c, struct output *o)
+{
+    int needed = 2 * o->nvalues + 1;
+    if (c->iov_cap < needed)
+    {
+        c->iov_cap = needed > 16 ? needed : 16;
+        c->iov = (struct iovec *)realloc(c->iov, c->iov_cap * sizeof(struct iovec));
+    }
+
+    int n = 0;
+    size_t prev = 0;
+    for (int i = 0; i < o->nvalues; i++)
+    {
+        // Every value follows its bulk header, so the buffered part is never empty
+        c->iov[n].iov_base = o->buf + prev;
+        c->iov[n].iov_len = o->values[i].offset - prev;
+        n++;
+        c->iov[n].iov_base = (void *)o->values[i].value.data;
+        c->iov[n].iov_len = o->values[i].value.len;
+        n++;
+        prev = o->values[i].offset;
+    }
+    c->iov[n].iov_base = o->buf + prev;
+    c->iov[n].iov_len = o->len - prev;
+    n++;
+
+    c->iov_cnt = n;
+    c->iov_idx = 0;
+    return n;
+}
+
+// Empty the output once it is sent, unpinning its values
+void output_reset(struct output *o)
+{
+    for (int i = 0; i < o->nvalues; i++)
+    {
+        RELEASE_VALUE(&o->values[i].value);
+    }
+    o->nvalues = 0;
+    o->value_bytes = 0;
+    o->len = 0;
+}
+
+void output_free(struct output *o)
+{
+    output_reset(o);
+    free(o->buf);
+    free(o->values);
+    memset(o, 0, sizeof(*o));
+}
+
+// Whether the replies queued or in flight, pinned values included, are over OUTPUT_BACKLOG_LIMIT
+int output_backlogged(const struct client *c)
+{
+    return c->out.len + c->out.value_bytes + c->sending.len + c->sending.value_bytes > OUTPUT_BACKLOG_LIMIT;
+}
+
+// Reply to a write the engine could not log, it was not applied
+void reply_write_error(int client_fd)
+{
+    reply_error(client_fd, "Write could not be logged, see the server log");
+}
+
+// Handle SET command
+void handle_set(int client_fd, const struct resp_arg *key, const struct resp_arg *value)
+{
+    if (SET(key->ptr, key->len, value->ptr, value->len) == KV_ERROR)
+    {
+        reply_write_error(client_fd);
+        return;
+    }
+    reply_raw(client_fd, REPLY_OK, sizeof(REPLY_OK) - 1);
+}
+
+void reply_get(int client_fd, int found, struct kv_value *value)
+{
+    if (found == KV_FOUND)
+    {
+        reply_value(client_fd, value);
+        return;
+    }
+    if (found == KV_ERROR)
+    {
+        reply_error(client_fd, "Corrupt or unreadable data, see the server log");
+        return;
+    }
+    reply_raw(client_fd, REPLY_NIL, sizeof(REPLY_NIL) - 1);
+}
+
+void pause_client(int client_fd);
+void resume_client(int client_fd);
+
+// Monotonic clock in nanoseconds, for command latencies
+long long now_nanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Completion of a GET that had to read from disk
+void get_done(void *ctx, int found, struct kv_value *value)
+{
+    int client_fd = CTX_FD(ctx);
+    struct client *c = get_client(client_fd);
+    if (c->gen != CTX_GEN(ctx))
+    {
+        // The client went away while the read was in flight
+        if (found == KV_FOUND)
+        {
+            RELEASE_VALUE(value);
+        }
+        return;
+    }
+
+    c->pending = 0;
+    reply_get(client_fd, found, value);
+    STATS_RECORD_COMMAND(KV_CMD_GET, c->pending_start < 0 ? -1 : now_nanos() - c->pending_start);
+    resume_client(client_fd);
+}
+
+// Handle GET command, the reply comes from get_done if a disk read is needed
+void handle_get(int client_fd, const struct resp_arg *key)
+{
+    struct kv_value value;
+    struct client *c = get_client(client_fd);
+
+    int found = GET_ASYNC(key->ptr, key->len, &value, get_done, CLIENT_CTX(client_fd, c->gen));
+    if (found == KV_PENDING)
+    {
+        c->pending = 1;
+        pause_client(client_fd);
+        return;
+    }
+    reply_get(client_fd, found, &value);
+}
+
+void reply_del(int client_fd, int deleted)
+{
+    if (deleted == KV_ERROR)
+    {
+        // The keys before it stay deleted, like separate DELs
+        reply_write_error(client_fd);
+        return;
+    }
+    reply_integer(client_fd, deleted);
+}
+
+// Completion of a DEL whose existence check had to read from disk
+void del_done(void *ctx, int deleted)
+{
+    int client_fd = CTX_FD(ctx);
+    struct client *c = get_client(client_fd);
+    if (c->gen != CTX_GEN(ctx))
+    {
+        // The client went away, the deletes still happened
+        return;
+    }
+
+    c->pending = 0;
+    reply_del(client_fd, deleted);
+    STATS_RECORD_COMMAND(KV_CMD_DEL, c->pending_start < 0 ? -1 : now_nanos() - c->pending_start);
+    resume_client(client_fd);
+}
+
+// Handle DEL command, the reply comes from del_done if a disk read is needed
+void handle_del(int client_fd, long nkeys, const struct resp_arg *keys)
+{
+    struct client *c = get_client(client_fd);
+    struct kv_key *list = (struct kv_key *)malloc(nkeys * sizeof(struct kv_key));
+    for (long i = 0; i < nkeys; i++)
+    {
+        list[i].data = keys[i].ptr;
+        list[i].len = keys[i].len;
+    }
+    int deleted = DEL_ASYNC(list, nkeys, blind_delete, del_done, CLIENT_CTX(client_fd, c->gen));
+    free(list);
+    if (deleted == KV_PENDING)
+    {
+        c->pending = 1;
+        pause_client(client_fd);
+        return;
+    }
+    reply_del(client_fd, deleted);
+}
+
+// Handle MERGE command, appends to the value without reading it
+void handle_merge(int client_fd, const struct resp_arg *key, const struct resp_arg *operand)
+{
+    if (MERGE(key->ptr, key->len, operand->ptr, operand->len) == KV_ERROR)
+    {
+        reply_write_error(client_fd);
+        return;
+    }
+    reply_raw(client_fd, REPLY_OK, sizeof(REPLY_OK) - 1);
+}
+
+// Handle INGEST path: links tables built by sst_build, replies with their count
+void handle_ingest(int client_fd, const struct resp_arg *path)
+{
+    int tables = INGEST(path->ptr, path->len);
+    if (tables < 0)
+    {
+        reply_error(client_fd, "Ingest failed, see the server log");
+        return;
+    }
+    reply_integer(client_fd, tables);
+}
+
+// Parses a non-negative decimal argument
+int parse_number(const struct resp_arg *arg, unsigned long *n)
+{
+    if (arg->len == 0 || arg->len > 19)
+    {
+        return 0;
+    }
+    *n = 0;
+    for (size_t i = 0; i < arg->len; i++)
+    {
+        if (arg->ptr[i] < '0' || arg->ptr[i] > '9')
+        {
             return 0;
+        }
+        *n = *n * 10 + (arg->ptr[i] - '0');
+    }
+    return 1;
+}
+
+void end_scan(struct client *c)
+{
+    if (c->scan_cursor == 0)
+    {
+        return;
+    }
+    SCAN_CLOSE(c->scan_it);
+    RELEASE_SNAPSHOT(c->scan_snapshot);
+    c->scan_cursor = 0;
+}
 
-        // Get the first argument (key) if it exists
-        char *len_key = strtok(NULL, "\r\n");
-        *arg1 = strtok(NULL, "\r\n");
+// Handle SCAN cursor [COUNT n]. Cursor 0 takes a snapshot, the following calls
+// walk it, so a scan sees every key live at its start exactly once
+void handle_scan(int client_fd, long argc, const struct resp_arg *argv)
+{
+    struct client *c = get_client(client_fd);
+    unsigned long cursor, count = SCAN_DEFAULT_COUNT;
 
-        char *len_value = strtok(NULL, "\r\n");
-        if (len_value == NULL)
-            return 1;
-        // Get the second argument (value for SET) if it exists
-        *arg2 = strtok(NULL, "\r\n");
+    if (!parse_number(&argv[1], &cursor) || (argc != 2 && argc != 4) ||
+        (argc == 4 && (!resp_arg_is(&argv[2], "COUNT") || !parse_number(&argv[3], &count) || count == 0)))
+    {
+        reply_error(client_fd, "Invalid command or arguments");
+        return;
+    }
+    if (cursor == 0)
+    {
+        end_scan(c);
+        c->scan_snapshot = SNAPSHOT();
+        c->scan_it = SCAN(c->scan_snapshot, "", 0);
+        c->scan_cursor = next_scan_cursor++;
+    }
+    else if (cursor != c->scan_cursor)
+    {
+        reply_error(client_fd, "invalid cursor");
+        return;
+    }
 
-        // If there are arguments and the command is valid, return success
-        return 1;
+    // Keys are collected first, the array header needs their number
+    struct output keys = {0};
+    unsigned long n = 0;
+    const char *key;
+    size_t key_len;
+    struct kv_value value;
+    char header[32];
+    int found = KV_FOUND;
+    while (n < count && (found = SCAN_NEXT(c->scan_it, &key, &key_len, &value)) == KV_FOUND)
+    {
+        RELEASE_VALUE(&value);
+        size_t header_len = format_number(header, '$', key_len);
+        reserve_output(&keys, header_len + key_len + 2);
+        memcpy(keys.buf + keys.len, header, header_len);
+        memcpy(keys.buf + keys.len + header_len, key, key_len);
+        memcpy(keys.buf + keys.len + header_len + key_len, CRLF, 2);
+        keys.len += header_len + key_len + 2;
+        n++;
     }
+    if (found == KV_ERROR)
+    {
+        free(keys.buf);
+        end_scan(c);
+        reply_error(client_fd, "Corrupt or unreadable data, see the server log");
+        return;
+    }
+
+    // A short batch means the scan is complete
+    unsigned long next = n < count ? 0 : c->scan_cursor;
+    if (next == 0)
+    {
+        end_scan(c);
+    }
+
+    char digits[24];
+    int digits_len = snprintf(digits, sizeof(digits), "%lu", next);
+    reply_raw(client_fd, "*2\r\n", 4);
+    reply_raw(client_fd, header, format_number(header, '$', digits_len));
+    reply_raw(client_fd, digits, digits_len);
+    reply_raw(client_fd, CRLF, 2);
+    reply_raw(client_fd, header, format_number(header, '*', n));
+    if (keys.len > 0)
+    {
+        reply_raw(client_fd, keys.buf, keys.len);
+    }
+    free(keys.buf);
+}
+
+// Whether a command only writes, so it can go into a write batch
+int is_batch_command(long argc, const struct resp_arg *argv)
+{
+    return (resp_arg_is(&argv[0], "SET") && argc == 3) ||
+           (resp_arg_is(&argv[0], "DEL") && argc >= 2) ||
+           (resp_arg_is(&argv[0], "MERGE") && argc == 3) ||
+           (resp_arg_is(&argv[0], "MSET") && argc >= 3 && argc % 2 == 1);
+}
 
-    // Return failure if the message does not start with '*'
+// Adds a write command to a batch and replies as if it had run
+void batch_command(int client_fd, struct kv_batch *batch, long argc, const struct resp_arg *argv)
+{
+    if (resp_arg_is(&argv[0], "DEL"))
+    {
+        size_t deleted = 0;
+        for (long i = 1; i < argc; i++)
+        {
+            deleted += BATCH_DELETE(batch, argv[i].ptr, argv[i].len, blind_delete);
+        }
+        reply_integer(client_fd, deleted);
+        return;
+    }
+    if (resp_arg_is(&argv[0], "MERGE"))
+    {
+        BATCH_MERGE(batch, argv[1].ptr, argv[1].len, argv[2].ptr, argv[2].len);
+    }
+    else
+    {
+        // SET and MSET
+        for (long i = 1; i + 1 < argc; i += 2)
+        {
+            BATCH_PUT(batch, argv[i].ptr, argv[i].len, argv[i + 1].ptr, argv[i + 1].len);
+        }
+    }
+    reply_raw(client_fd, REPLY_OK, sizeof(REPLY_OK) - 1);
+}
+
+// Writes a batch whose replies were added to the output from mark on. If it
+// cannot be logged they are replaced by an error, nothing was applied.
+void write_batch_reply(int client_fd, struct kv_batch *batch, size_t mark)
+{
+    if (BATCH_WRITE(batch) == KV_ERROR)
+    {
+        // Batch replies are plain bytes, no value is pinned past mark
+        get_client(client_fd)->out.len = mark;
+        reply_write_error(client_fd);
+    }
+    BATCH_FREE(batch);
+}
+
+// Handle MSET key value [key value ...], all pairs land atomically
+void handle_mset(int client_fd, long argc, const struct resp_arg *argv)
+{
+    size_t mark = get_client(client_fd)->out.len;
+    struct kv_batch *batch = BATCH_NEW();
+    batch_command(client_fd, batch, argc, argv);
+    write_batch_reply(client_fd, batch, mark);
+}
+
+void end_multi(struct client *c)
+{
+    c->in_multi = 0;
+    c->multi_failed = 0;
+    c->multi_count = 0;
+    c->multi.len = 0;
+}
+
+// Inside MULTI: keep the command for EXEC, only writes can be queued. EXEC
+// applies the queue as one write batch with nothing to answer a read from, so
+// unlike Redis a queued GET or other read fails the transaction with EXECABORT.
+void queue_command(int client_fd, long argc, const struct resp_arg *argv)
+{
+    struct client *c = get_client(client_fd);
+    if (!is_batch_command(argc, argv))
+    {
+        c->multi_failed = 1;
+        reply_error(client_fd, "Only SET, DEL, MERGE and MSET can be queued in MULTI");
+        return;
+    }
+
+    char header[32];
+    size_t header_len = format_number(header, '*', argc);
+    reserve_output(&c->multi, header_len);
+    memcpy(c->multi.buf + c->multi.len, header, header_len);
+    c->multi.len += header_len;
+    for (long i = 0; i < argc; i++)
+    {
+        header_len = format_number(header, '$', argv[i].len);
+        reserve_output(&c->multi, header_len + argv[i].len + 2);
+        memcpy(c->multi.buf + c->multi.len, header, header_len);
+        memcpy(c->multi.buf + c->multi.len + header_len, argv[i].ptr, argv[i].len);
+        memcpy(c->multi.buf + c->multi.len + header_len + argv[i].len, CRLF, 2);
+        c->multi.len += header_len + argv[i].len + 2;
+    }
+    c->multi_count++;
+    reply_raw(client_fd, REPLY_QUEUED, sizeof(REPLY_QUEUED) - 1);
+}
+
+// Handle EXEC: the queued commands become one write batch
+void handle_exec(int client_fd)
+{
+    struct client *c = get_client(client_fd);
+    if (!c->in_multi)
+    {
+        reply_error(client_fd, "EXEC without MULTI");
+        return;
+    }
+    if (c->multi_failed)
+    {
+        static const char EXECABORT[] = "-EXECABORT Transaction discarded because of previous errors.\r\n";
+        reply_raw(client_fd, EXECABORT, sizeof(EXECABORT) - 1);
+        end_multi(c);
+        return;
+    }
+
+    size_t mark = c->out.len;
+    char header[32];
+    reply_raw(client_fd, header, format_number(header, '*', c->multi_count));
+
+    struct kv_batch *batch = BATCH_NEW();
+    struct resp_parser parser;
+    resp_parser_init(&parser);
+    size_t off = 0, consumed;
+    while (off < c->multi.len && resp_parse(&parser, c->multi.buf + off, c->multi.len - off, &consumed) == RESP_OK)
+    {
+        batch_command(client_fd, batch, parser.argc, parser.argv);
+        off += consumed;
+    }
+    resp_parser_free(&parser);
+
+    write_batch_reply(client_fd, batch, mark);
+    end_multi(c);
+}
+
+// Handle INFO: the engine's statistics as one bulk string, sections are ignored
+void handle_info(int client_fd)
+{
+    size_t cap = 8192, len;
+    char *text = (char *)malloc(cap);
+    while ((len = STATS_INFO(text, cap)) >= cap)
+    {
+        cap = len + 1024;
+        text = (char *)realloc(text, cap);
+    }
+
+    char header[32];
+    reply_raw(client_fd, header, format_number(header, '$', len));
+    reply_raw(client_fd, text, len);
+    reply_raw(client_fd, CRLF, 2);
+    free(text);
+}
+
+// Execute one parsed command, its reply is appended to the client's output.
+// Returns the command's kv_command for its latency histogram.
+int dispatch_command(int client_fd, long argc, const struct resp_arg *argv)
+{
+    struct client *c = get_client(client_fd);
+
+    if (resp_arg_is(&argv[0], "MULTI") && argc == 1)
+    {
+        if (c->in_multi)
+        {
+            reply_error(client_fd, "MULTI calls can not be nested");
+            return KV_CMD_MULTI;
+        }
+        c->in_multi = 1;
+        reply_raw(client_fd, REPLY_OK, sizeof(REPLY_OK) - 1);
+        return KV_CMD_MULTI;
+    }
+    if (resp_arg_is(&argv[0], "EXEC") && argc == 1)
+    {
+        handle_exec(client_fd);
+        return KV_CMD_EXEC;
+    }
+    if (resp_arg_is(&argv[0], "DISCARD") && argc == 1)
+    {
+        if (!c->in_multi)
+        {
+            reply_error(client_fd, "DISCARD without MULTI");
+            return KV_CMD_DISCARD;
+        }
+        end_multi(c);
+        reply_raw(client_fd, REPLY_OK, sizeof(REPLY_OK) - 1);
+        return KV_CMD_DISCARD;
+    }
+    if (c->in_multi)
+    {
+        queue_command(client_fd, argc, argv);
+        return KV_CMD_OTHER;
+    }
+
+    if (resp_arg_is(&argv[0], "SET") && argc == 3)
+    {
+        handle_set(client_fd, &argv[1], &argv[2]);
+        return KV_CMD_SET;
+    }
+    if (resp_arg_is(&argv[0], "GET") && argc == 2)
+    {
+        handle_get(client_fd, &argv[1]);
+        return KV_CMD_GET;
+    }
+    if (resp_arg_is(&argv[0], "DEL") && argc >= 2)
+    {
+        handle_del(client_fd, argc - 1, &argv[1]);
+        return KV_CMD_DEL;
+    }
+    if (resp_arg_is(&argv[0], "MERGE") && argc == 3)
+    {
+        handle_merge(client_fd, &argv[1], &argv[2]);
+        return KV_CMD_MERGE;
+    }
+    if (resp_arg_is(&argv[0], "MSET") && argc >= 3 && argc % 2 == 1)
+    {
+        handle_mset(client_fd, argc, argv);
+        return KV_CMD_MSET;
+    }
+    if (resp_arg_is(&argv[0], "SCAN") && argc >= 2)
+    {
+        handle_scan(client_fd, argc, argv);
+        return KV_CMD_SCAN;
+    }
+    if (resp_arg_is(&argv[0], "INGEST") && argc == 2)
+    {
+        handle_ingest(client_fd, &argv[1]);
+        return KV_CMD_INGEST;
+    }
+    if (resp_arg_is(&argv[0], "INFO") && argc <= 2)
+    {
+        handle_info(client_fd);
+        return KV_CMD_INFO;
+    }
+    reply_error(client_fd, "Invalid command or arguments");
+    return KV_CMD_OTHER;
+}
+
+// Execute one parsed command and count it, timing the sampled ones. A GET or
+// DEL waiting on a disk read is recorded by get_done or del_done.
+void process_command(int client_fd, long argc, const struct resp_arg *argv)
+{
+    if (argc == 0)
+    {
+        return;
+    }
+    long long start = STATS_SAMPLE() ? now_nanos() : -1;
+    int command = dispatch_command(client_fd, argc, argv);
+    struct client *c = get_client(client_fd);
+    if (c->pending)
+    {
+        c->pending_start = start;
+        return;
+    }
+    STATS_RECORD_COMMAND(command, start < 0 ? -1 : now_nanos() - start);
+}
+
+void flush_client(int client_fd);
+
+// Execute every complete command buffered for a client, returns -1 on a protocol error
+int process_input(int client_fd)
+{
+    struct client *c = get_client(client_fd);
+    size_t off = 0;
+
+    while (!c->pending && off < c->in_len)
+    {
+        if (output_backlogged(c))
+        {
+            // A client that does not read its replies is served again once they drained
+            flush_client(client_fd);
+            if (output_backlogged(c))
+            {
+                break;
+            }
+        }
+        size_t consumed;
+        int ret = resp_parse(&c->parser, c->in + off, c->in_len - off, &consumed);
+        if (ret == RESP_INCOMPLETE)
+        {
+            break;
+        }
+        if (ret == RESP_ERROR)
+        {
+            reply_error(client_fd, "Protocol error");
+            flush_client(client_fd);
+            return -1;
+        }
+        off += consumed;
+        process_command(client_fd, c->parser.argc, c->parser.argv);
+    }
+
+    // Every reply produced by this batch goes out in one send
+    flush_client(client_fd);
+
+    // Drop executed bytes, a partial command moves to the front
+    if (off > 0)
+    {
+        memmove(c->in, c->in + off, c->in_len - off);
+        c->in_len -= off;
+    }
+    if (c->in_len == 0 && c->in_cap > 64 * MAXLINE)
+    {
+        // Give back the memory of a huge bulk string
+        free(c->in);
+        c->in = NULL;
+        c->in_cap = 0;
+    }
     return 0;
 }
 
-// Build the RESP2 response
-char *build_resp(const char *message)
+// Set the socket to non-blocking
+void set_non_blocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1)
+    {
+        perror("fcntl(F_GETFL)");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Close a client socket and drop it from the select set
+void close_client(int client_fd)
+{
+    struct client *c = get_client(client_fd);
+    c->gen++;
+    c->pending = 0;
+    c->closing = 0;
+    c->eof = 0;
+    free(c->in);
+    c->in = NULL;
+    c->in_len = c->in_cap = 0;
+    resp_parser_free(&c->parser);
+    output_free(&c->out);
+    output_free(&c->sending);
+    end_scan(c);
+    end_multi(c);
+    output_free(&c->multi);
+
+    c->send_in_flight = 0;
+    c->watched = 0;
+
+    if (client_fd < FD_SETSIZE)
+    {
+        FD_CLR(client_fd, &master_fds);
+        FD_CLR(client_fd, &master_write_fds);
+    }
+    close(client_fd);
+}
+
+// Watches the client for input unless a GET is pending or its replies are
+// backlogged, and for writability while a send is unfinished (select and epoll)
+void watch_client(int client_fd)
+{
+    struct client *c = get_client(client_fd);
+    int watch = 0;
+    if (!c->pending && !output_backlogged(c))
+        watch |= WATCH_READ;
+    if (c->send_in_flight)
+        watch |= WATCH_WRITE;
+    if (watch == c->watched || backend == BACKEND_URING)
+    {
+        return;
+    }
+
+    if (backend == BACKEND_SELECT)
+    {
+        if (watch & WATCH_READ)
+            FD_SET(client_fd, &master_fds);
+        else
+            FD_CLR(client_fd, &master_fds);
+        if (watch & WATCH_WRITE)
+            FD_SET(client_fd, &master_write_fds);
+        else
+            FD_CLR(client_fd, &master_write_fds);
+    }
+    else if (watch == 0)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL);
+    }
+    else
+    {
+        struct epoll_event ev;
+        ev.events = ((watch & WATCH_READ) ? EPOLLIN : 0) | ((watch & WATCH_WRITE) ? EPOLLOUT : 0);
+        ev.data.fd = client_fd;
+        epoll_ctl(epoll_fd, c->watched == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, client_fd, &ev);
+    }
+    c->watched = watch;
+}
+
+// Sends as much of the client's replies as the socket takes without blocking.
+// Replies queued meanwhile follow once the send in flight is done. What the
+// socket did not take waits for it to become writable.
+void continue_send(int client_fd)
 {
-    size_t len = strlen(message);
-    char *response = (char *)malloc(len + 4); // Adding 4 for the RESP header (`+` and `\r\n`)
-    sprintf(response, "+%s\r\n", message);
-    return response;
-}
+    struct client *c = get_client(client_fd);
+    while (c->send_in_flight || c->out.len > 0)
+    {
+        if (!c->send_in_flight)
+        {
+            struct output tmp = c->sending;
+            c->sending = c->out;
+            c->out = tmp;
+            output_iov(c, &c->sending);
+            c->send_in_flight = 1;
+        }
 
-char *build_resp_get(const char *message)
-{
-    size_t len = strlen(message);
-    char *response = (char *)malloc(len + 6); // Adding 7 for the RESP header (`$len\r\n` and `\r\n`)
-    sprintf(response, "$%zu\r\n%s\r\n", len, message);
-    return response;
-}
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = c->iov + c->iov_idx;
+        msg.msg_iovlen = c->iov_cnt - c->iov_idx;
+        ssize_t sent = sendmsg(client_fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (sent >= 0)
+        {
+            struct iovec *iov = c->iov + c->iov_idx;
+            int iovcnt = c->iov_cnt - c->iov_idx;
+            advance_iov(&iov, &iovcnt, sent);
+            c->iov_idx = c->iov_cnt - iovcnt;
+            if (iovcnt > 0)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            // The peer is gone, the read side notices and closes the client
+            output_reset(&c->out);
+        }
 
-char *build_error(const char *message)
-{
-    size_t len = strlen(message);
-    char *response = (char *)malloc(len + 8); // Adding 9 for the RESP header (`-ERR ` and `\r\n`)
-    sprintf(response, "-ERR %s\r\n", message);
-    return response;
+        c->send_in_flight = 0;
+        if (c->sending.cap > 64 * MAXLINE)
+        {
+            output_free(&c->sending);
+        }
+        else
+        {
+            output_reset(&c->sending);
+        }
+    }
+    watch_client(client_fd);
 }
 
-// Handle SET command
-void handle_set(int sockfd, const char *key, const char *value)
-{
-    SET(key, value);
-    char *response = build_resp("OK");
-    send_message(sockfd, response, strlen(response)); // Use send instead of write
-    free(response);
-}
+void uring_start_send(struct uring *ring, int client_fd);
 
-// Handle GET command
-void handle_get(int sockfd, const char *key)
+// Send the client's buffered replies on the active backend
+void flush_client(int client_fd)
 {
-    const char *result = GET(key);
-
-    if (result && strcmp(result, "tombstone") != 0)
+    struct client *c = get_client(client_fd);
+    if (c->out.len == 0)
     {
-        char *response = build_resp_get(result);
-        send_message(sockfd, response, strlen(response)); // Use send instead of write
-        free(response);
+        return;
     }
-    else
+    if (backend == BACKEND_URING)
     {
-        char *response = build_error("Key not found");
-        send_message(sockfd, response, strlen(response)); // Use send instead of write
-        free(response);
+        // A send already in flight picks this up when it completes
+        if (!c->send_in_flight)
+        {
+            uring_start_send(server_ring, client_fd);
+        }
+        return;
     }
-}
 
-// Handle DEL command
-void handle_del(int sockfd, const char *key)
-{
-    const char *result = GET(key);
-    if (result && strcmp(result, "tombstone") != 0)
+    // A send waiting for the socket picks this up when it is writable
+    if (!c->send_in_flight)
     {
-        DEL(key);
-        char *response = build_resp("OK");
-        send_message(sockfd, response, strlen(response)); // Use send instead of write
-        free(response);
+        continue_send(client_fd);
     }
-    else
+}
+
+// Close a client after a protocol error
+void drop_client(int client_fd)
+{
+    if (backend == BACKEND_URING)
     {
-        char *response = build_error("Key not found");
-        send_message(sockfd, response, strlen(response)); // Use send instead of write
-        free(response);
+        // Shut down after the error reply went out, the multishot recv then completes with EOF and closes it
+        struct client *c = get_client(client_fd);
+        c->closing = 1;
+        if (!c->send_in_flight)
+        {
+            shutdown(client_fd, SHUT_RDWR);
+        }
+        return;
     }
+    close_client(client_fd);
 }
 
-// Set the socket to non-blocking
-void set_non_blocking(int fd)
+// Stop reading from a client while its GET or DEL waits on disk. The uring backend
+// keeps receiving into the input buffer instead.
+void pause_client(int client_fd)
 {
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags == -1)
+    watch_client(client_fd);
+}
+
+void resume_client(int client_fd)
+{
+    watch_client(client_fd);
+
+    // Commands pipelined behind the GET or DEL are already buffered
+    if (process_input(client_fd) < 0)
     {
-        perror("fcntl(F_GETFL)");
-        exit(EXIT_FAILURE);
+        drop_client(client_fd);
     }
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
 // Main server loop
 void handle_client(int client_fd)
 {
-    char buffer[MAXLINE];
     ssize_t n;
 
-    // while (1) {
-    n = receive_message(client_fd, buffer, MAXLINE); // Use recv instead of read
-    if (n == 0)
+    n = receive_message(client_fd, get_client(client_fd)); // Use recv instead of read
+    if (n < 0)
     {
-        close(client_fd);
+        close_client(client_fd);
         return;
     }
-    // if (n == 0) {
-    //     // Client closed the connection
-    //     // close(client_fd);
-    //     break;
-    // }
-    // else if (n < 0) {
-    //     if (errno == EAGAIN || errno == EWOULDBLOCK) {
-    //         // No data available yet, just return to the event loop
-    //         break;
-    //     }
-    //     perror("recv");
-    //     close(client_fd);
-    //     break;
-    // }
-
-    buffer[n] = '\0'; // Null terminate the message
-    char *command = NULL, *arg1 = NULL, *arg2 = NULL;
 
-    if (parse_resp(buffer, &command, &arg1, &arg2))
+    if (process_input(client_fd) < 0)
     {
-        if (strcmp(command, "SET") == 0 && arg1 && arg2)
-        {
-            handle_set(client_fd, arg1, arg2);
-        }
-        else if (strcmp(command, "GET") == 0 && arg1)
-        {
-            handle_get(client_fd, arg1);
-        }
-        else if (strcmp(command, "DEL") == 0 && arg1)
-        {
-            handle_del(client_fd, arg1);
-        }
-        else
-        {
-            char *response = build_error("Invalid command or arguments");
-            send_message(client_fd, response, strlen(response)); // Use send instead of write
-            free(response);
-        }
+        close_client(client_fd);
     }
-    // }
 }
 
-// Start server
-void start_server(const char *host, int port)
+// The socket of a client with unsent replies became writable. Commands held
+// back by the backlog run once it drained.
+void handle_writable(int client_fd)
 {
-    int server_fd;
-    int client_fds[MAX_CLIENTS + 1];
-    for (int i = 0; i < MAX_CLIENTS + 1; i++)
+    struct client *c = get_client(client_fd);
+    continue_send(client_fd);
+    if (!c->pending && !output_backlogged(c) && c->in_len > 0 && process_input(client_fd) < 0)
     {
-        client_fds[i] = 0;
+        close_client(client_fd);
     }
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
+}
+
+// Create the non-blocking listening socket
+int create_server_socket(const char *host, int port)
+{
+    int server_fd;
+    struct sockaddr_in server_addr;
 
     server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0)
@@ -297,15 +1196,33 @@ void start_server(const char *host, int port)
     printf("Server running on %s:%d\n", host, port);
 
     set_non_blocking(server_fd);
+    return server_fd;
+}
 
-    fd_set read_fds;
+// select() event loop
+void start_server_select(int server_fd)
+{
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+
+    fd_set read_fds, write_fds;
     int max_fd = server_fd;
     FD_ZERO(&master_fds);
+    FD_ZERO(&master_write_fds);
     FD_SET(server_fd, &master_fds);
+    if (io_fd >= 0)
+    {
+        FD_SET(io_fd, &master_fds);
+        if (io_fd > max_fd)
+        {
+            max_fd = io_fd;
+        }
+    }
 
     while (1)
     {
         read_fds = master_fds;
+        write_fds = master_write_fds;
         // Add all client sockets to read_fds
         // for (int i = 3; i <= max_fd; i++) {
         //     if (i != server_fd) {
@@ -314,7 +1231,7 @@ void start_server(const char *host, int port)
         // }
 
         // Wait for an activity on the sockets
-        int activity = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
+        int activity = select(max_fd + 1, &read_fds, &write_fds, NULL, NULL);
 
         if (activity < 0)
         {
@@ -335,13 +1252,20 @@ void start_server(const char *host, int port)
                 perror("accept()");
                 continue;
             }
+            if (client_fd >= FD_SETSIZE)
+            {
+                // select() cannot watch this descriptor, use the epoll or uring backend
+                close(client_fd);
+                continue;
+            }
 
             // printf("New connection from %s\n", inet_ntoa(client_addr.sin_addr));
 
             set_non_blocking(client_fd);
 
             // Add new client socket to read_fds
-            FD_SET(client_fd, &master_fds);
+            get_client(client_fd)->watched = 0;
+            watch_client(client_fd);
             if (client_fd > max_fd)
             {
                 max_fd = client_fd;
@@ -351,18 +1275,398 @@ void start_server(const char *host, int port)
         // if(FD_ISSET(STDIN_FILENO, &read_fds)){
         //     printf("ok done\n");
         // }
-        // Handle data for all clients
+        // Finished disk reads resume their clients
+        if (io_fd >= 0 && FD_ISSET(io_fd, &read_fds))
+        {
+            poll_async_io();
+        }
+
+        // Handle data for all clients, sends first as they may let reads resume
         for (int i = 3; i <= max_fd; i++)
         {
-            if (FD_ISSET(i, &read_fds))
+            if (FD_ISSET(i, &write_fds))
+            {
+                handle_writable(i);
+            }
+            if (FD_ISSET(i, &read_fds) && FD_ISSET(i, &master_fds))
             {
-                if (i != server_fd)
+                if (i != server_fd && i != io_fd)
                 {
                     handle_client(i);
                 }
             }
         }
     }
+}
+
+// epoll() event loop, level triggered so handle_client is shared with select
+void start_server_epoll(int server_fd)
+{
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    struct epoll_event ev, events[MAX_EVENTS];
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0)
+    {
+        perror("epoll_create1()");
+        exit(EXIT_FAILURE);
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = server_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev);
+    if (io_fd >= 0)
+    {
+        ev.data.fd = io_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, io_fd, &ev);
+    }
+
+    while (1)
+    {
+        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (nfds < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait()");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < nfds; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == io_fd)
+            {
+                poll_async_io();
+                continue;
+            }
+            if (fd != server_fd)
+            {
+                struct client *c = get_client(fd);
+                if (events[i].events & EPOLLOUT)
+                {
+                    handle_writable(fd);
+                }
+                if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && (c->watched & WATCH_READ))
+                {
+                    handle_client(fd);
+                }
+                continue;
+            }
+
+            // Drain the accept queue
+            while (1)
+            {
+                int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
+                if (client_fd < 0)
+                {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK)
+                        perror("accept()");
+                    break;
+                }
+                set_non_blocking(client_fd);
+                get_client(client_fd)->watched = 0;
+                watch_client(client_fd);
+            }
+        }
+    }
+}
+
+// io_uring event loop: multishot accept and recv on a provided buffer ring,
+// replies are queued as SENDs and submitted together once per loop iteration
+enum uring_op_type
+{
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_POLL_IO
+};
+
+#define URING_OP_SHIFT 56
+#define URING_DATA(op, val) (((uint64_t)(op) << URING_OP_SHIFT) | (uint64_t)(val))
+#define URING_DATA_OP(data) ((int)((data) >> URING_OP_SHIFT))
+#define URING_DATA_VAL(data) ((data) & ((1ULL << URING_OP_SHIFT) - 1))
+
+struct io_uring_sqe *uring_sqe(struct uring *ring)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    while (sqe == NULL)
+    {
+        // Submission queue full, flush it and retry
+        uring_submit_and_wait(ring, 0);
+        sqe = uring_get_sqe(ring);
+    }
+    return sqe;
+}
+
+void uring_queue_accept(struct uring *ring, int server_fd)
+{
+    struct io_uring_sqe *sqe = uring_sqe(ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_DATA(URING_OP_ACCEPT, server_fd);
+}
+
+void uring_queue_recv(struct uring *ring, int client_fd)
+{
+    struct io_uring_sqe *sqe = uring_sqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = URING_DATA(URING_OP_RECV, client_fd);
+}
+
+// Watch the engine's completion eventfd
+void uring_queue_poll_io(struct uring *ring)
+{
+    struct io_uring_sqe *sqe = uring_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = io_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = URING_DATA(URING_OP_POLL_IO, io_fd);
+}
+
+// Send the unsent part of the client's gather list
+void uring_submit_send(struct uring *ring, int client_fd)
+{
+    struct client *c = get_client(client_fd);
+    memset(&c->msg, 0, sizeof(c->msg));
+    c->msg.msg_iov = c->iov + c->iov_idx;
+    c->msg.msg_iovlen = c->iov_cnt - c->iov_idx;
+
+    struct io_uring_sqe *sqe = uring_sqe(ring);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = client_fd;
+    sqe->addr = (unsigned long)&c->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = URING_DATA(URING_OP_SEND, client_fd);
+}
+
+// Hand the buffered replies to the kernel, new replies go to the other buffer meanwhile
+void uring_start_send(struct uring *ring, int client_fd)
+{
+    struct client *c = get_client(client_fd);
+    struct output tmp = c->sending;
+    c->sending = c->out;
+    c->out = tmp;
+    output_iov(c, &c->sending);
+    c->send_in_flight = 1;
+    uring_submit_send(ring, client_fd);
+}
+
+void uring_handle_recv(struct uring *ring, struct uring_buf_ring *br, struct io_uring_cqe *cqe)
+{
+    int client_fd = (int)URING_DATA_VAL(cqe->user_data);
+
+    if (cqe->res <= 0)
+    {
+        if (cqe->res == -ENOBUFS)
+        {
+            // Ran out of provided buffers, they are recycled below so just re-arm
+            uring_queue_recv(ring, client_fd);
+        }
+        else if (!(cqe->flags & IORING_CQE_F_MORE))
+        {
+            // EOF or error terminated the multishot receive. The send in
+            // flight still references the client's buffer, close after it.
+            struct client *c = get_client(client_fd);
+            if (c->send_in_flight)
+            {
+                c->eof = 1;
+            }
+            else
+            {
+                close_client(client_fd);
+            }
+        }
+        return;
+    }
+
+    unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    struct client *c = get_client(client_fd);
+
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        uring_queue_recv(ring, client_fd);
+    }
+    if (c->closing)
+    {
+        uring_buf_ring_recycle(br, bid);
+        return;
+    }
+
+    // While a GET or DEL is pending the input just accumulates, resume_client runs it
+    reserve_input(c, cqe->res);
+    memcpy(c->in + c->in_len, uring_buf_ring_addr(br, bid), cqe->res);
+    c->in_len += cqe->res;
+    uring_buf_ring_recycle(br, bid);
+
+    if (process_input(client_fd) < 0)
+    {
+        drop_client(client_fd);
+    }
+}
+
+void uring_handle_send(struct uring *ring, struct io_uring_cqe *cqe)
+{
+    int client_fd = (int)URING_DATA_VAL(cqe->user_data);
+    struct client *c = get_client(client_fd);
+
+    if (cqe->res > 0 && !c->eof)
+    {
+        struct iovec *iov = c->iov + c->iov_idx;
+        int iovcnt = c->iov_cnt - c->iov_idx;
+        advance_iov(&iov, &iovcnt, cqe->res);
+        if (iovcnt > 0)
+        {
+            // Short send, queue the remainder
+            c->iov_idx = c->iov_cnt - iovcnt;
+            uring_submit_send(ring, client_fd);
+            return;
+        }
+    }
+
+    c->send_in_flight = 0;
+    output_reset(&c->sending);
+    if (c->eof)
+    {
+        close_client(client_fd);
+    }
+    else if (cqe->res > 0 && c->out.len > 0)
+    {
+        // Replies produced while this send was in flight
+        uring_start_send(ring, client_fd);
+    }
+    else if (c->closing)
+    {
+        shutdown(client_fd, SHUT_RDWR);
+    }
+    else if (cqe->res > 0 && !c->pending && c->in_len > 0 && process_input(client_fd) < 0)
+    {
+        // Commands held back while the replies were backlogged
+        drop_client(client_fd);
+    }
+}
+
+void start_server_uring(int server_fd)
+{
+    struct uring ring;
+    struct uring_buf_ring br;
+
+    int ret = uring_init(&ring, URING_ENTRIES, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN);
+    if (ret == -EINVAL)
+    {
+        // Older kernel without the setup hints
+        ret = uring_init(&ring, URING_ENTRIES, 0);
+    }
+    if (ret < 0)
+    {
+        fprintf(stderr, "io_uring setup failed: %s\n", strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+
+    ret = uring_setup_buf_ring(&ring, &br, URING_BUF_COUNT, URING_BUF_SIZE, URING_BUF_GROUP);
+    if (ret < 0)
+    {
+        fprintf(stderr, "io_uring buffer ring setup failed: %s\n", strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+
+    server_ring = &ring;
+    uring_queue_accept(&ring, server_fd);
+    if (io_fd >= 0)
+    {
+        uring_queue_poll_io(&ring);
+    }
+
+    while (1)
+    {
+        // One syscall submits every queued accept/recv/send and waits for work
+        ret = uring_submit_and_wait(&ring, 1);
+        if (ret < 0 && ret != -EBUSY)
+        {
+            fprintf(stderr, "io_uring_enter failed: %s\n", strerror(-ret));
+            exit(EXIT_FAILURE);
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&ring)) != NULL)
+        {
+            switch (URING_DATA_OP(cqe->user_data))
+            {
+            case URING_OP_ACCEPT:
+                if (cqe->res >= 0)
+                {
+                    uring_queue_recv(&ring, cqe->res);
+                }
+                if (!(cqe->flags & IORING_CQE_F_MORE))
+                {
+                    uring_queue_accept(&ring, server_fd);
+                }
+                break;
+            case URING_OP_RECV:
+                uring_handle_recv(&ring, &br, cqe);
+                break;
+            case URING_OP_SEND:
+                uring_handle_send(&ring, cqe);
+                break;
+            case URING_OP_POLL_IO:
+                poll_async_io();
+                if (!(cqe->flags & IORING_CQE_F_MORE))
+                {
+                    uring_queue_poll_io(&ring);
+                }
+                break;
+            }
+            uring_cqe_seen(&ring);
+        }
+    }
+
+    uring_free_buf_ring(&ring, &br);
+    uring_exit(&ring);
+}
+
+// Start server with the requested event loop backend
+void start_server(const char *host, int port, const char *backend_name)
+{
+    if (strcmp(backend_name, "select") == 0)
+    {
+        backend = BACKEND_SELECT;
+    }
+    else if (strcmp(backend_name, "epoll") == 0)
+    {
+        backend = BACKEND_EPOLL;
+    }
+    else if (strcmp(backend_name, "uring") == 0)
+    {
+        backend = BACKEND_URING;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown backend '%s', expected select, epoll or uring\n", backend_name);
+        exit(EXIT_FAILURE);
+    }
+
+    int server_fd = create_server_socket(host, port);
+
+    if (backend == BACKEND_SELECT)
+    {
+        start_server_select(server_fd);
+    }
+    else if (backend == BACKEND_EPOLL)
+    {
+        start_server_epoll(server_fd);
+    }
+    else
+    {
+        start_server_uring(server_fd);
+    }
 
     close(server_fd);
 }
@@ -371,15 +1675,30 @@ int main(int argc, char *argv[])
 {
     const char *host = "127.0.0.1";
     int port = PORT;
+    const char *backend_name = "select";
 
     if (argc > 1)
     {
         port = atoi(argv[1]);
     }
+    if (argc > 2)
+    {
+        backend_name = argv[2];
+    }
+    if (argc > 3 && strcmp(argv[3], "blind") == 0)
+    {
+        blind_delete = 1;
+    }
 
     // init_db(); // Initialize the database library and functions
+    if (start_value_log() < 0 || start_wal() < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
     start_compaction();
-    start_server(host, port);
+    start_stats_dump();
+    io_fd = start_async_io();
+    start_server(host, port, backend_name);
 
     // dlclose(libdb); // Close the library after the server shuts down
     return 0;
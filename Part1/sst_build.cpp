@@ -0,0 +1,256 @@
+// Offline SSTable builder for bulk loads. Sorts key<TAB>value lines, the last
+// line of a key winning, and writes non-overlapping tables in the engine's
+// format for INGEST. Inputs larger than BUILD_RUN_KEYS are sorted in runs
+// spilled to disk and merged.
+// Usage: ./sst_build <input> <output_dir> [keys_per_table]
+#include "lsm.cpp"
+
+// Reads one record in the data block format, false at the end of the stream
+bool readRecord(istream &in, Record &record)
+{
+    char header[RECORD_HEADER_SIZE];
+    if (!in.read(header, RECORD_HEADER_SIZE))
+    {
+        return false;
+    }
+    uint32_t key_len, value_len;
+    record.type = (RecordType)header[0];
+    memcpy(&record.seq, header + 1, sizeof(record.seq));
+    memcpy(&key_len, header + 9, sizeof(key_len));
+    memcpy(&value_len, header + 13, sizeof(value_len));
+    record.key.resize(key_len);
+    record.value.resize(value_len);
+    return in.read(&record.key[0], key_len) && in.read(&record.value[0], value_len);
+}
+
+// Sorts by key, and among equal keys keeps only the last input line
+void sortRun(vector<Record> &records)
+{
+    sort(records.begin(), records.end(), [](const Record &a, const Record &b)
+         { return a.key != b.key ? a.key < b.key : a.seq < b.seq; });
+    size_t n = 0;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        if (i + 1 < records.size() && records[i + 1].key == records[i].key)
+        {
+            continue;
+        }
+        if (n != i)
+        {
+            records[n] = std::move(records[i]);
+        }
+        n++;
+    }
+    records.resize(n);
+}
+
+class TableWriter
+{
+private:
+    string output_dir;
+    int keys_per_table;
+    vector<Record> pending;
+
+public:
+    int num_tables = 0;
+    long num_keys = 0;
+    bool failed = false; // A table could not be written
+
+    TableWriter(const string &dir, int keys) : output_dir(dir), keys_per_table(keys) {}
+
+    // Records arrive in key order. Sequence 0 makes them older than any write in the store.
+    void add(Record record)
+    {
+        record.seq = 0;
+        pending.push_back(std::move(record));
+        if ((int)pending.size() == keys_per_table)
+        {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        if (pending.empty())
+        {
+            return;
+        }
+        // Ingested tables land at the bottom, so they get the bottom codec
+        SSTable table({(int)pending.size(), pending.data()}, output_dir + "/" + to_string(num_tables++), BOTTOM_CODEC);
+        if (!table.is_built())
+        {
+            // The partial table is removed with table
+            cerr << "Error writing table " << table.get_folder_name() << endl;
+            failed = true;
+            pending.clear();
+            return;
+        }
+        table.keep_files();
+        num_keys += pending.size();
+        pending.clear();
+    }
+};
+
+struct RunCursor
+{
+    ifstream in;
+    Record current;
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "Usage: " << argv[0] << " <input> <output_dir> [keys_per_table]" << endl;
+        return 1;
+    }
+    string output_dir = argv[2];
+    int keys_per_table = argc > 3 ? atoi(argv[3]) : INGEST_TABLE_KEYS;
+    if (keys_per_table <= 0)
+    {
+        cerr << "keys_per_table must be positive" << endl;
+        return 1;
+    }
+    if (keys_per_table > INGEST_TABLE_KEYS)
+    {
+        // Each table's Bloom filter is sized for this many keys, more would saturate it
+        cerr << "keys_per_table capped at " << INGEST_TABLE_KEYS << endl;
+        keys_per_table = INGEST_TABLE_KEYS;
+    }
+
+    ifstream input(argv[1], ios::binary);
+    if (!input)
+    {
+        cerr << "Error opening file: " << argv[1] << endl;
+        return 1;
+    }
+    error_code ec;
+    fs::create_directories(output_dir, ec);
+    if (ec || !fs::is_empty(output_dir))
+    {
+        cerr << "Output directory " << output_dir << " must be new or empty" << endl;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<Record> records;
+    vector<string> runs;
+    string line;
+    uint64_t line_no = 0;
+    size_t input_bytes = 0;
+    while (getline(input, line))
+    {
+        line_no++;
+        input_bytes += line.size() + 1;
+        if (line.empty())
+        {
+            continue;
+        }
+        size_t tab = line.find('\t');
+        if (tab == string::npos)
+        {
+            cerr << "Line " << line_no << ": expected key<TAB>value" << endl;
+            return 1;
+        }
+        // The line number orders duplicates of a key until the run is sorted
+        records.push_back({line.substr(0, tab), line.substr(tab + 1), line_no, RECORD_PUT});
+
+        if ((int)records.size() == BUILD_RUN_KEYS)
+        {
+            sortRun(records);
+            string run = output_dir + "/run_" + to_string(runs.size()) + ".tmp";
+            ofstream out(run, ios::binary);
+            for (const Record &record : records)
+            {
+                out << encodeRecord(record);
+            }
+            if (!out)
+            {
+                cerr << "Error writing file: " << run << endl;
+                return 1;
+            }
+            runs.push_back(run);
+            records.clear();
+        }
+    }
+
+    TableWriter writer(output_dir, keys_per_table);
+    sortRun(records);
+    if (runs.empty())
+    {
+        // The input fit into one run, no merge needed
+        for (Record &record : records)
+        {
+            writer.add(std::move(record));
+        }
+    }
+    else
+    {
+        vector<RunCursor> cursors(runs.size() + 1);
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            cursors[i].in.open(runs[i], ios::binary);
+        }
+        size_t next_in_memory = 0;
+        auto advance = [&](size_t idx)
+        {
+            if (idx < runs.size())
+            {
+                return readRecord(cursors[idx].in, cursors[idx].current);
+            }
+            if (next_in_memory == records.size())
+            {
+                return false;
+            }
+            cursors[idx].current = std::move(records[next_in_memory++]);
+            return true;
+        };
+
+        // Smallest key first, the latest line first among equal keys
+        auto order = [&](size_t a, size_t b)
+        {
+            const Record &x = cursors[a].current, &y = cursors[b].current;
+            return x.key != y.key ? x.key > y.key : x.seq < y.seq;
+        };
+        priority_queue<size_t, vector<size_t>, decltype(order)> heap(order);
+        for (size_t i = 0; i < cursors.size(); i++)
+        {
+            if (advance(i))
+            {
+                heap.push(i);
+            }
+        }
+
+        string last_key;
+        bool first = true;
+        while (!heap.empty())
+        {
+            size_t idx = heap.top();
+            heap.pop();
+            if (first || cursors[idx].current.key != last_key)
+            {
+                last_key = cursors[idx].current.key;
+                first = false;
+                writer.add(cursors[idx].current);
+            }
+            if (advance(idx))
+            {
+                heap.push(idx);
+            }
+        }
+        for (const string &run : runs)
+        {
+            fs::remove(run, ec);
+        }
+    }
+    writer.flush();
+    if (writer.failed)
+    {
+        return 1;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Wrote " << writer.num_keys << " keys in " << writer.num_tables << " tables to " << output_dir
+         << " in " << seconds << " s (" << input_bytes / seconds / (1 << 20) << " MB/s of input)" << endl;
+    return 0;
+}
@@ -0,0 +1,292 @@
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// Engine counters, each bumped by the thread doing the work
+enum Counter
+{
+    GETS_MEMTABLE,          // GETs the memtable answered
+    GETS_ROW_CACHE,         // GETs the row cache answered
+    GETS_TABLES,            // GETs that searched the tables
+    READ_ERRORS,            // GETs that failed on an unreadable or corrupt block
+    FILTER_CHECKS,          // Bloom filter probes of tables covering the key
+    FILTER_NEGATIVES,       // Probes that ruled the table out
+    FILTER_FALSE_POSITIVES, // Probes that passed, but the key was not in the table
+    BLOCK_CACHE_HITS,
+    BLOCK_CACHE_MISSES,
+    KEYS_WRITTEN,
+    BYTES_WRITTEN, // Keys and values of the writes
+    WAL_BYTES,
+    FLUSHES,
+    BYTES_FLUSHED,
+    COMPACTIONS,
+    COMPACTION_BYTES_READ,
+    COMPACTION_BYTES_WRITTEN,
+    COUNTERS
+};
+
+const char *const COUNTER_NAMES[COUNTERS] = {
+    "gets_memtable", "gets_row_cache", "gets_tables", "read_errors", "filter_checks", "filter_negatives",
+    "filter_false_positives", "block_cache_hits", "block_cache_misses", "keys_written", "bytes_written",
+    "wal_bytes", "flushes", "bytes_flushed", "compactions", "compaction_bytes_read", "compaction_bytes_written"};
+
+// Engine stages timed into latency histograms
+enum Stage
+{
+    STAGE_TABLE_LOOKUP, // Table part of a GET, block reads included
+    STAGE_BLOCK_READ,   // A block read from disk and decoded
+    STAGE_WAL_APPEND,
+    STAGE_WRITE_STALL, // Time a delayed or stopped write waited
+    STAGE_FLUSH,       // Memtable written as a level 0 table
+    STAGE_COMPACTION,  // One compaction step, rate limiting included
+    STAGES
+};
+
+const char *const STAGE_NAMES[STAGES] = {"table_lookup", "block_read", "wal_append", "write_stall", "flush", "compaction"};
+
+// Server commands, in the order of enum kv_command
+const char *const COMMAND_NAMES[KV_COMMANDS] = {"get", "set", "del", "merge", "mset", "multi", "exec", "discard",
+                                               "scan", "ingest", "info", "other"};
+
+// Single writer, so a plain add and store is enough
+inline void bump(atomic<uint64_t> &counter, uint64_t n)
+{
+    counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// One thread's counts. Only that thread writes them, so an update is a relaxed
+// load and store to a line no other thread writes. Calls are counted exactly,
+// the histograms hold the sampled ones.
+struct ThreadStats
+{
+    atomic<uint64_t> counters[COUNTERS] = {};
+    atomic<uint64_t> command_calls[KV_COMMANDS] = {};
+    atomic<uint64_t> stage_calls[STAGES] = {};
+    LatencyHistogram commands[KV_COMMANDS];
+    LatencyHistogram stages[STAGES];
+    uint64_t command_ticks = 0; // Commands sample_command() was asked about, only the owner reads it
+
+    // Adds other's counts, the caller is this block's only writer meanwhile
+    void merge(const ThreadStats &other)
+    {
+        for (int i = 0; i < COUNTERS; i++)
+        {
+            bump(counters[i], other.counters[i].load(memory_order_relaxed));
+        }
+        for (int i = 0; i < KV_COMMANDS; i++)
+        {
+            bump(command_calls[i], other.command_calls[i].load(memory_order_relaxed));
+            commands[i].merge(other.commands[i]);
+        }
+        for (int i = 0; i < STAGES; i++)
+        {
+            bump(stage_calls[i], other.stage_calls[i].load(memory_order_relaxed));
+            stages[i].merge(other.stages[i]);
+        }
+    }
+};
+
+// Statistics with no shared state on the hot path: every thread records into
+// its own ThreadStats, readers sum all of them. A thread's counts move to
+// retired when it exits. Nothing is recorded unless STATS_ENABLED.
+class Statistics
+{
+private:
+    mutex mtx; // Guards threads and retired
+    vector<ThreadStats *> threads;
+    ThreadStats retired;
+
+    // Folds an exiting thread's counts into retired
+    struct Owner
+    {
+        ThreadStats *stats = nullptr;
+        Statistics *owner = nullptr;
+
+        ~Owner()
+        {
+            if (stats != nullptr)
+            {
+                owner->retire(stats);
+            }
+        }
+    };
+
+    ThreadStats *attach()
+    {
+        static thread_local Owner owner;
+        owner.stats = new ThreadStats;
+        owner.owner = this;
+        lock_guard<mutex> lock(mtx);
+        threads.push_back(owner.stats);
+        return owner.stats;
+    }
+
+    void retire(ThreadStats *stats)
+    {
+        lock_guard<mutex> lock(mtx);
+        retired.merge(*stats);
+        threads.erase(std::find(threads.begin(), threads.end(), stats));
+        delete stats;
+    }
+
+    // The calling thread's block, the process has one Statistics
+    ThreadStats &local()
+    {
+        static thread_local ThreadStats *mine = nullptr;
+        if (mine == nullptr)
+        {
+            mine = attach();
+        }
+        return *mine;
+    }
+
+    // Every thread's counts summed into a fresh block
+    ThreadStats *snapshot()
+    {
+        ThreadStats *total = new ThreadStats;
+        lock_guard<mutex> lock(mtx);
+        total->merge(retired);
+        for (ThreadStats *stats : threads)
+        {
+            total->merge(*stats);
+        }
+        return total;
+    }
+
+    static void latency_line(string &text, const char *prefix, const char *name, uint64_t calls, const LatencyHistogram &histogram)
+    {
+        if (calls == 0)
+        {
+            return;
+        }
+        char line[256];
+        snprintf(line, sizeof(line), "latency_%s%s:calls=%llu,sampled=%llu,mean=%.2f,p50=%.2f,p99=%.2f,p99.9=%.2f,max=%.2f\r\n",
+                 prefix, name, (unsigned long long)calls, (unsigned long long)histogram.count(), histogram.mean() / 1000,
+                 histogram.percentile(50) / 1000.0, histogram.percentile(99) / 1000.0,
+                 histogram.percentile(99.9) / 1000.0, histogram.maximum() / 1000.0);
+        text += line;
+    }
+
+public:
+    void add(Counter counter, uint64_t n = 1)
+    {
+        if (STATS_ENABLED)
+        {
+            bump(local().counters[counter], n);
+        }
+    }
+
+    // Whether the calling thread should time its next run of a frequent stage:
+    // one in STATS_SAMPLE_INTERVAL is, reading the clock costs more than the counting
+    bool sample(Stage stage)
+    {
+        return STATS_ENABLED && local().stage_calls[stage].load(memory_order_relaxed) % STATS_SAMPLE_INTERVAL == 0;
+    }
+
+    bool sample_command()
+    {
+        return STATS_ENABLED && local().command_ticks++ % STATS_SAMPLE_INTERVAL == 0;
+    }
+
+    // Counts a stage, and records its latency unless nanos is negative (not timed)
+    void record_stage(Stage stage, int64_t nanos)
+    {
+        if (STATS_ENABLED)
+        {
+            ThreadStats &stats = local();
+            bump(stats.stage_calls[stage], 1);
+            if (nanos >= 0)
+            {
+                stats.stages[stage].record(nanos);
+            }
+        }
+    }
+
+    void record_command(int command, int64_t nanos)
+    {
+        if (STATS_ENABLED && command >= 0 && command < KV_COMMANDS)
+        {
+            ThreadStats &stats = local();
+            bump(stats.command_calls[command], 1);
+            if (nanos >= 0)
+            {
+                stats.commands[command].record(nanos);
+            }
+        }
+    }
+
+    // Counters as INFO lines, `name:value`, with the filter's false positive
+    // rate among the tables that did not hold the key, and the block cache hit rate
+    string counters_text()
+    {
+        ThreadStats *total = snapshot();
+        uint64_t values[COUNTERS];
+        string text;
+        char line[128];
+        for (int i = 0; i < COUNTERS; i++)
+        {
+            values[i] = total->counters[i].load(memory_order_relaxed);
+            snprintf(line, sizeof(line), "%s:%llu\r\n", COUNTER_NAMES[i], (unsigned long long)values[i]);
+            text += line;
+        }
+        delete total;
+
+        uint64_t absent = values[FILTER_NEGATIVES] + values[FILTER_FALSE_POSITIVES];
+        uint64_t lookups = values[BLOCK_CACHE_HITS] + values[BLOCK_CACHE_MISSES];
+        snprintf(line, sizeof(line), "filter_false_positive_rate:%.4f\r\nblock_cache_hit_rate:%.4f\r\n",
+                 absent ? (double)values[FILTER_FALSE_POSITIVES] / absent : 0.0,
+                 lookups ? (double)values[BLOCK_CACHE_HITS] / lookups : 0.0);
+        text += line;
+        return text;
+    }
+
+    // Latency histograms as INFO lines in microseconds, commands then engine
+    // stages, those never recorded are left out
+    string latency_text()
+    {
+        ThreadStats *total = snapshot();
+        string text;
+        for (int i = 0; i < KV_COMMANDS; i++)
+        {
+            latency_line(text, "cmd_", COMMAND_NAMES[i], total->command_calls[i].load(memory_order_relaxed), total->commands[i]);
+        }
+        for (int i = 0; i < STAGES; i++)
+        {
+            latency_line(text, "stage_", STAGE_NAMES[i], total->stage_calls[i].load(memory_order_relaxed), total->stages[i]);
+        }
+        delete total;
+        return text;
+    }
+};
+
+// Counts a stage from construction to destruction, and times it if timed
+class StageTimer
+{
+private:
+    Statistics &statistics;
+    Stage stage;
+    bool timed;
+    chrono::steady_clock::time_point start;
+
+public:
+    StageTimer(Statistics &statistics, Stage stage, bool timed = STATS_ENABLED)
+        : statistics(statistics), stage(stage), timed(timed)
+    {
+        if (timed)
+        {
+            start = chrono::steady_clock::now();
+        }
+    }
+
+    ~StageTimer()
+    {
+        statistics.record_stage(stage, timed ? chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() : -1);
+    }
+};
@@ -0,0 +1,193 @@
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// fsyncs a directory, so the entries created in it survive a crash
+bool sync_directory(const string &dir)
+{
+    int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+// Writes a table's data file front to back. Appends gather in an aligned
+// buffer of TABLE_WRITE_BUFFER_SIZE bytes, which goes out in one write when full,
+// so the file may also be opened with O_DIRECT. With TABLE_SYNC the written
+// range is handed to writeback every TABLE_SYNC_INTERVAL bytes, leaving little
+// for the single fdatasync at the end. The file is preallocated to the
+// expected size and cut to the bytes written when finished.
+class TableFileWriter
+{
+private:
+    int fd = -1;
+    string path;
+    char *buffer = nullptr;
+    size_t buffered = 0;  // Bytes in the buffer
+    uint64_t flushed = 0; // Bytes written to the file
+    uint64_t synced = 0;  // Bytes handed to writeback
+    bool direct = false;
+    bool failed = false;
+
+    // Writes the first len bytes of the buffer at flushed, both aligned under O_DIRECT
+    bool write_buffer(size_t len)
+    {
+        size_t off = 0;
+        while (off < len)
+        {
+            ssize_t n = pwrite(fd, buffer + off, len - off, flushed + off);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EINVAL && direct)
+            {
+                // The filesystem took the O_DIRECT open but not the write
+                direct = false;
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                continue;
+            }
+            if (n < 0)
+            {
+                cerr << "Error writing table file " << path << ": " << strerror(errno) << endl;
+                return false;
+            }
+            off += n;
+        }
+        return true;
+    }
+
+    // Writes out the full buffer
+    void flush()
+    {
+        failed = failed || !write_buffer(buffered);
+        flushed += buffered;
+        buffered = 0;
+        if (TABLE_SYNC && !failed && flushed - synced >= TABLE_SYNC_INTERVAL)
+        {
+            sync_file_range(fd, synced, flushed - synced, SYNC_FILE_RANGE_WRITE);
+            synced = flushed;
+        }
+    }
+
+public:
+    ~TableFileWriter()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        free(buffer);
+    }
+
+    bool open(const string &file_path, uint64_t expected_size)
+    {
+        path = file_path;
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, BLOCK_ALIGNMENT, TABLE_WRITE_BUFFER_SIZE) != 0)
+        {
+            cerr << "Error allocating the write buffer of " << path << endl;
+            return false;
+        }
+        buffer = static_cast<char *>(ptr);
+
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        if (TABLE_DIRECT_WRITE)
+        {
+            fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+            direct = fd >= 0;
+        }
+        if (fd < 0)
+        {
+            // Without O_DIRECT support writes go through the page cache
+            fd = ::open(path.c_str(), flags, 0644);
+        }
+        if (fd < 0)
+        {
+            cerr << "Error creating table file " << path << ": " << strerror(errno) << endl;
+            return false;
+        }
+
+        // One extent for the whole table where the filesystem supports it
+        if (expected_size > 0)
+        {
+            fallocate(fd, 0, 0, expected_size);
+        }
+        return true;
+    }
+
+    uint64_t offset() const
+    {
+        return flushed + buffered;
+    }
+
+    // Returns the offset the data starts at
+    uint64_t append(const char *data, size_t len)
+    {
+        uint64_t start = offset();
+        while (len > 0 && fd >= 0)
+        {
+            size_t n = min(len, TABLE_WRITE_BUFFER_SIZE - buffered);
+            memcpy(buffer + buffered, data, n);
+            buffered += n;
+            data += n;
+            len -= n;
+            if (buffered == TABLE_WRITE_BUFFER_SIZE)
+            {
+                flush();
+            }
+        }
+        return start;
+    }
+
+    uint64_t append(const string &data)
+    {
+        return append(data.data(), data.size());
+    }
+
+    // Writes out the rest and, with TABLE_SYNC, makes the file and its folder
+    // durable. False if any write failed.
+    bool finish()
+    {
+        if (fd < 0)
+        {
+            return false;
+        }
+        size_t len = buffered;
+        if (direct)
+        {
+            // O_DIRECT writes whole aligned blocks, the padding is cut off below
+            len = (buffered + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+            memset(buffer + buffered, 0, len - buffered);
+        }
+        failed = failed || !write_buffer(len);
+        flushed += buffered;
+        buffered = 0;
+
+        // Also gives back the preallocated space past the end
+        if (!failed && ftruncate(fd, flushed) < 0)
+        {
+            cerr << "Error truncating table file " << path << ": " << strerror(errno) << endl;
+            failed = true;
+        }
+        if (!failed && TABLE_SYNC)
+        {
+            // The folder is as new as the file, its own entry needs syncing too
+            fs::path folder = fs::path(path).parent_path();
+            if (fdatasync(fd) < 0 || !sync_directory(folder.string()) || !sync_directory(folder.parent_path().string()))
+            {
+                cerr << "Error syncing table file " << path << ": " << strerror(errno) << endl;
+                failed = true;
+            }
+        }
+        close(fd);
+        fd = -1;
+        return !failed;
+    }
+};
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(struct uring *ring, unsigned entries, unsigned flags)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = flags;
+    memset(ring, 0, sizeof(*ring));
+
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+    ring->ring_fd = fd;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring_ptr = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring_ptr == MAP_FAILED)
+    {
+        close(fd);
+        return -errno;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ring_ptr = ring->sq_ring_ptr;
+    }
+    else
+    {
+        ring->cq_ring_ptr = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring_ptr == MAP_FAILED)
+        {
+            munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+            close(fd);
+            return -errno;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        uring_exit(ring);
+        return -errno;
+    }
+
+    char *sq = (char *)ring->sq_ring_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+
+    char *cq = (char *)ring->cq_ring_ptr;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return 0;
+}
+
+void uring_exit(struct uring *ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring_ptr && ring->cq_ring_ptr != ring->sq_ring_ptr)
+        munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+    if (ring->sq_ring_ptr)
+        munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+    close(ring->ring_fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries)
+    {
+        return NULL;
+    }
+
+    unsigned idx = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    ring->sq_array[idx] = idx;
+    ring->sqe_tail++;
+
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(struct uring *ring, unsigned wait_nr)
+{
+    unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    if (to_submit == 0 && wait_nr == 0)
+    {
+        return 0;
+    }
+
+    int ret;
+    do
+    {
+        ret = sys_io_uring_enter(ring->ring_fd, to_submit, wait_nr, flags);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_setup_buf_ring(struct uring *ring, struct uring_buf_ring *br, unsigned entries, unsigned buf_size, unsigned short bgid)
+{
+    memset(br, 0, sizeof(*br));
+    br->entries = entries;
+    br->buf_size = buf_size;
+    br->bgid = bgid;
+
+    // The ring itself must be page aligned, entries must be a power of two
+    br->ring_size = entries * sizeof(struct io_uring_buf);
+    void *mem = mmap(NULL, br->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return -errno;
+    }
+    br->ring = (struct io_uring_buf_ring *)mem;
+
+    br->buffers = (char *)malloc((size_t)entries * buf_size);
+    if (br->buffers == NULL)
+    {
+        munmap(mem, br->ring_size);
+        return -ENOMEM;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)mem;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        int err = errno;
+        free(br->buffers);
+        munmap(mem, br->ring_size);
+        return -err;
+    }
+
+    // Hand every buffer to the kernel
+    for (unsigned bid = 0; bid < entries; bid++)
+    {
+        struct io_uring_buf *buf = &br->ring->bufs[bid];
+        buf->addr = (unsigned long)(br->buffers + (size_t)bid * buf_size);
+        buf->len = buf_size;
+        buf->bid = bid;
+    }
+    __atomic_store_n(&br->ring->tail, (unsigned short)entries, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void uring_free_buf_ring(struct uring *ring, struct uring_buf_ring *br)
+{
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->bgid;
+    sys_io_uring_register(ring->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+    munmap(br->ring, br->ring_size);
+    free(br->buffers);
+    memset(br, 0, sizeof(*br));
+}
+
+char *uring_buf_ring_addr(struct uring_buf_ring *br, unsigned bid)
+{
+    return br->buffers + (size_t)bid * br->buf_size;
+}
+
+void uring_buf_ring_recycle(struct uring_buf_ring *br, unsigned bid)
+{
+    unsigned short tail = br->ring->tail;
+    struct io_uring_buf *buf = &br->ring->bufs[tail & (br->entries - 1)];
+    buf->addr = (unsigned long)uring_buf_ring_addr(br, bid);
+    buf->len = br->buf_size;
+    buf->bid = bid;
+    __atomic_store_n(&br->ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
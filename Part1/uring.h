@@ -0,0 +1,72 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Minimal io_uring wrapper on top of the raw syscalls (no liburing dependency)
+struct uring
+{
+    int ring_fd;
+
+    // Submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sqe_tail; // Local tail, published on submit
+    struct io_uring_sqe *sqes;
+
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring_ptr;
+    size_t sq_ring_size;
+    void *cq_ring_ptr;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+// Provided buffer ring used by multishot receives
+struct uring_buf_ring
+{
+    struct io_uring_buf_ring *ring;
+    size_t ring_size;
+    char *buffers;
+    unsigned entries;
+    unsigned buf_size;
+    unsigned short bgid;
+};
+
+int uring_init(struct uring *ring, unsigned entries, unsigned flags);
+void uring_exit(struct uring *ring);
+
+// Returns NULL when the submission queue is full
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+// Submits all queued SQEs in one io_uring_enter and waits for wait_nr completions
+int uring_submit_and_wait(struct uring *ring, unsigned wait_nr);
+
+// Returns the next completion or NULL, uring_cqe_seen releases it
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+void uring_cqe_seen(struct uring *ring);
+
+int uring_setup_buf_ring(struct uring *ring, struct uring_buf_ring *br, unsigned entries, unsigned buf_size, unsigned short bgid);
+void uring_free_buf_ring(struct uring *ring, struct uring_buf_ring *br);
+char *uring_buf_ring_addr(struct uring_buf_ring *br, unsigned bid);
+void uring_buf_ring_recycle(struct uring_buf_ring *br, unsigned bid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // URING_H
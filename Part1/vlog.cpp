@@ -0,0 +1,385 @@
+#include <map>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Append-only segment files holding large values apart from the tables, so
+// compaction moves 16-byte pointers instead of the values. Each table references
+// the segments its pointers point into, and a sealed segment is deleted once no
+// table references it any more.
+// Segment entry: key length (4), value length (4), key, CRC32C of the value (4), value.
+// A table's segments are synced before the table is used, see sync().
+// Pointer, the value of a RECORD_VALUE_REF record: segment (4), value offset (8), value length (4)
+class ValueLog
+{
+private:
+    struct Segment
+    {
+        uint32_t id;
+        int fd;
+        size_t size = 0;   // Bytes appended
+        size_t synced = 0; // Bytes known to be on disk
+        size_t dead = 0; // Bytes of values no table needs any more, as counted by compaction
+        int refs = 0;    // Tables pointing into the segment
+        bool collected = false;
+
+        ~Segment()
+        {
+            close(fd);
+        }
+    };
+
+    string dir;
+    map<uint32_t, shared_ptr<Segment>> segments;
+    shared_ptr<Segment> active;
+    uint32_t next_id = 0;
+    mutex mtx;
+
+    string segment_path(uint32_t id)
+    {
+        return dir + "/" + to_string(id) + ".log";
+    }
+
+    // Seals the active segment and starts a new one, called with mtx held
+    bool roll()
+    {
+        auto segment = make_shared<Segment>();
+        segment->id = next_id++;
+        segment->fd = ::open(segment_path(segment->id).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (segment->fd < 0)
+        {
+            cerr << "Error creating value log segment: " << strerror(errno) << endl;
+            return false;
+        }
+        if (active != nullptr && active->refs == 0)
+        {
+            remove(active);
+        }
+        segments[segment->id] = segment;
+        active = segment;
+        return true;
+    }
+
+    // Drops a sealed segment nothing references, readers holding it keep the fd open
+    void remove(const shared_ptr<Segment> &segment)
+    {
+        unlink(segment_path(segment->id).c_str());
+        segments.erase(segment->id);
+    }
+
+    // Appends one entry and references its segment for the caller, returns the pointer
+    string append(const string &key, const string &value, set<uint32_t> &referenced)
+    {
+        lock_guard<mutex> lock(mtx);
+        if (active->size >= VLOG_SEGMENT_SIZE && !roll())
+        {
+            return "";
+        }
+
+        uint32_t key_len = key.size(), value_len = value.size();
+        uint32_t crc = crc32c(value.data(), value.size());
+        string entry(2 * sizeof(uint32_t), '\0');
+        memcpy(&entry[0], &key_len, sizeof(key_len));
+        memcpy(&entry[4], &value_len, sizeof(value_len));
+        entry += key;
+        entry.append(reinterpret_cast<const char *>(&crc), sizeof(crc));
+        entry += value;
+
+        size_t off = 0;
+        while (off < entry.size())
+        {
+            ssize_t n = pwrite(active->fd, entry.data() + off, entry.size() - off, active->size + off);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                cerr << "Error appending to value log: " << strerror(errno) << endl;
+                return "";
+            }
+            off += n;
+        }
+
+        uint64_t value_pos = active->size + entry.size() - value.size();
+        active->size += entry.size();
+        if (referenced.insert(active->id).second)
+        {
+            active->refs++;
+        }
+
+        string pointer(VLOG_POINTER_SIZE, '\0');
+        memcpy(&pointer[0], &active->id, sizeof(uint32_t));
+        memcpy(&pointer[4], &value_pos, sizeof(uint64_t));
+        memcpy(&pointer[12], &value_len, sizeof(uint32_t));
+        return pointer;
+    }
+
+public:
+    // Segments left by an earlier run are dropped, no table survives a restart yet
+    bool open(const string &path)
+    {
+        lock_guard<mutex> lock(mtx);
+        dir = path;
+        error_code ec;
+        fs::remove_all(dir, ec);
+        fs::create_directories(dir, ec);
+        if (ec)
+        {
+            cerr << "Error creating value log directory " << dir << ": " << ec.message() << endl;
+            return false;
+        }
+        return roll();
+    }
+
+    bool is_open()
+    {
+        return active != nullptr;
+    }
+
+    static bool decode_pointer(const char *data, size_t len, uint32_t &segment, uint64_t &offset, uint32_t &value_len)
+    {
+        if (len != VLOG_POINTER_SIZE)
+        {
+            return false;
+        }
+        memcpy(&segment, data, sizeof(uint32_t));
+        memcpy(&offset, data + 4, sizeof(uint64_t));
+        memcpy(&value_len, data + 12, sizeof(uint32_t));
+        return true;
+    }
+
+    // Moves values of at least VLOG_THRESHOLD bytes out of records about to form a
+    // table, leaving pointers. Returns the segments the records point into, each
+    // referenced once for the table, which releases them with unref.
+    vector<uint32_t> separate(Record *records, int num_records)
+    {
+        set<uint32_t> referenced;
+        for (int i = 0; i < num_records && is_open(); i++)
+        {
+            Record &record = records[i];
+            if (record.type == RECORD_PUT && record.value.size() >= VLOG_THRESHOLD)
+            {
+                string pointer = append(record.key, record.value, referenced);
+                if (!pointer.empty())
+                {
+                    record.value = std::move(pointer);
+                    record.type = RECORD_VALUE_REF;
+                }
+            }
+            else if (record.type == RECORD_VALUE_REF)
+            {
+                // Carried over by compaction, the input table still holds its segment
+                uint32_t segment, value_len;
+                uint64_t offset;
+                if (decode_pointer(record.value.data(), record.value.size(), segment, offset, value_len) && !referenced.count(segment))
+                {
+                    lock_guard<mutex> lock(mtx);
+                    auto it = segments.find(segment);
+                    if (it != segments.end())
+                    {
+                        it->second->refs++;
+                        referenced.insert(segment);
+                    }
+                }
+            }
+        }
+        return vector<uint32_t>(referenced.begin(), referenced.end());
+    }
+
+    // Makes the entries appended so far to the given segments durable, false if
+    // that failed. Only needed with TABLE_SYNC, as the tables using them are not synced either.
+    bool sync(const vector<uint32_t> &referenced)
+    {
+        if (!TABLE_SYNC)
+        {
+            return true;
+        }
+        for (uint32_t id : referenced)
+        {
+            shared_ptr<Segment> segment;
+            size_t size = 0;
+            {
+                lock_guard<mutex> lock(mtx);
+                auto it = segments.find(id);
+                if (it == segments.end() || it->second->synced == it->second->size)
+                {
+                    continue;
+                }
+                segment = it->second;
+                size = segment->size;
+            }
+            if (fdatasync(segment->fd) < 0)
+            {
+                cerr << "Error syncing value log segment " << id << ": " << strerror(errno) << endl;
+                return false;
+            }
+            lock_guard<mutex> lock(mtx);
+            segment->synced = max(segment->synced, size);
+        }
+        return true;
+    }
+
+    void unref(const vector<uint32_t> &referenced)
+    {
+        lock_guard<mutex> lock(mtx);
+        for (uint32_t id : referenced)
+        {
+            auto it = segments.find(id);
+            if (it != segments.end() && --it->second->refs == 0 && it->second != active)
+            {
+                remove(it->second);
+            }
+        }
+    }
+
+    // Where the entry a pointer refers to is stored: the segment's fd, pinned with
+    // the segment so that it stays open, and the offset and length of the entry's
+    // checksum and value. False if the pointer is damaged or its segment is gone.
+    bool locate(const char *pointer, size_t len, shared_ptr<const int> &fd, uint64_t &offset, size_t &size)
+    {
+        uint32_t id, value_len;
+        if (!decode_pointer(pointer, len, id, offset, value_len) || offset < sizeof(uint32_t))
+        {
+            return false;
+        }
+        lock_guard<mutex> lock(mtx);
+        auto it = segments.find(id);
+        if (it == segments.end())
+        {
+            return false;
+        }
+        fd = shared_ptr<const int>(it->second, &it->second->fd);
+        offset -= sizeof(uint32_t);
+        size = sizeof(uint32_t) + value_len;
+        return true;
+    }
+
+    // The value of an entry read from where locate() points, nullptr if it fails its checksum
+    static shared_ptr<const string> check_entry(const char *entry, size_t len)
+    {
+        uint32_t crc;
+        if (len < sizeof(crc))
+        {
+            return nullptr;
+        }
+        memcpy(&crc, entry, sizeof(crc));
+        if (crc != crc32c(entry + sizeof(crc), len - sizeof(crc)))
+        {
+            return nullptr;
+        }
+        return make_shared<const string>(entry + sizeof(crc), len - sizeof(crc));
+    }
+
+    // The value a pointer refers to, nullptr if it cannot be read or fails its checksum
+    shared_ptr<const string> read(const char *pointer, size_t len)
+    {
+        shared_ptr<const int> fd;
+        uint64_t offset;
+        size_t size;
+        if (!locate(pointer, len, fd, offset, size))
+        {
+            cerr << "Dangling value log pointer" << endl;
+            return nullptr;
+        }
+        // The checksum and the value in one read
+        string entry(size, '\0');
+        size_t off = 0;
+        while (off < size)
+        {
+            ssize_t n = pread(*fd, &entry[off], size - off, offset + off);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            off += n;
+        }
+        shared_ptr<const string> value = off == size ? check_entry(entry.data(), size) : nullptr;
+        if (value == nullptr)
+        {
+            cerr << "Unreadable value log entry at " << offset << endl;
+        }
+        return value;
+    }
+
+    // Counts a value whose pointer compaction dropped as garbage
+    void discard(const Record &record)
+    {
+        uint32_t id, value_len;
+        uint64_t offset;
+        if (record.type != RECORD_VALUE_REF || !decode_pointer(record.value.data(), record.value.size(), id, offset, value_len))
+        {
+            return;
+        }
+        lock_guard<mutex> lock(mtx);
+        auto it = segments.find(id);
+        if (it != segments.end())
+        {
+            it->second->dead += 3 * sizeof(uint32_t) + record.key.size() + value_len;
+        }
+    }
+
+    // The sealed segment with the most garbage, if at least VLOG_GC_RATIO of it is; -1 if none
+    int64_t gc_candidate()
+    {
+        lock_guard<mutex> lock(mtx);
+        int64_t victim = -1;
+        double worst = VLOG_GC_RATIO;
+        for (auto &entry : segments)
+        {
+            const shared_ptr<Segment> &segment = entry.second;
+            if (segment == active || segment->collected || segment->size == 0)
+            {
+                continue;
+            }
+            double ratio = (double)segment->dead / segment->size;
+            if (ratio >= worst)
+            {
+                worst = ratio;
+                victim = segment->id;
+            }
+        }
+        return victim;
+    }
+
+    void mark_collected(uint32_t id)
+    {
+        lock_guard<mutex> lock(mtx);
+        auto it = segments.find(id);
+        if (it != segments.end())
+        {
+            it->second->collected = true;
+        }
+    }
+
+    // Turns pointers into victim back into inline values, so that building a
+    // table from the records appends them to the active segment again. False
+    // if a value could not be read, the records must not be used then.
+    bool inline_values(Record *records, int num_records, uint32_t victim)
+    {
+        for (int i = 0; i < num_records; i++)
+        {
+            uint32_t id, value_len;
+            uint64_t offset;
+            Record &record = records[i];
+            if (record.type != RECORD_VALUE_REF || !decode_pointer(record.value.data(), record.value.size(), id, offset, value_len) || id != victim)
+            {
+                continue;
+            }
+            shared_ptr<const string> value = read(record.value.data(), record.value.size());
+            if (value == nullptr)
+            {
+                return false;
+            }
+            record.value = *value;
+            record.type = RECORD_PUT;
+        }
+        return true;
+    }
+};
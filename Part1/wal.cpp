@@ -0,0 +1,143 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Append-only log of write batches, one entry per batch. It covers the
+// memtable and is emptied once the memtable is flushed to an SSTable.
+// Entry: payload length (4 bytes), CRC32C of length and payload (4 bytes), payload
+class WriteAheadLog
+{
+private:
+    int fd = -1;
+    string path;
+    off_t size = 0; // Bytes of complete entries, a failed append is cut back to it
+
+    // Covers the length too, so a zero-filled tail does not pass as an empty entry
+    static uint32_t entry_crc(uint32_t len, const char *payload)
+    {
+        return crc32c(payload, len, crc32c((const char *)&len, sizeof(len)));
+    }
+
+public:
+    bool open(const string &log_path)
+    {
+        path = log_path;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            cerr << "Error opening write-ahead log " << path << ": " << strerror(errno) << endl;
+            return false;
+        }
+        size = lseek(fd, 0, SEEK_END);
+        return true;
+    }
+
+    // One write() per batch, so a batch is either fully logged or a torn tail.
+    // Returns false if the batch is not durably logged, its partial entry is
+    // then cut off so later appends still follow a complete one.
+    bool append(const string &batch)
+    {
+        if (fd < 0)
+        {
+            return true;
+        }
+        uint32_t len = batch.size();
+        uint32_t crc = entry_crc(len, batch.data());
+        string entry(sizeof(len) + sizeof(crc), '\0');
+        memcpy(&entry[0], &len, sizeof(len));
+        memcpy(&entry[sizeof(len)], &crc, sizeof(crc));
+        entry += batch;
+
+        size_t off = 0;
+        while (off < entry.size())
+        {
+            ssize_t n = write(fd, entry.data() + off, entry.size() - off);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                cerr << "Error appending to write-ahead log: " << strerror(errno) << endl;
+                truncate_to(size);
+                return false;
+            }
+            off += n;
+        }
+        if (WAL_SYNC && fdatasync(fd) < 0)
+        {
+            cerr << "Error syncing write-ahead log: " << strerror(errno) << endl;
+            truncate_to(size);
+            return false;
+        }
+        size += entry.size();
+        return true;
+    }
+
+    void truncate_to(off_t length)
+    {
+        if (ftruncate(fd, length) < 0)
+        {
+            cerr << "Error truncating write-ahead log: " << strerror(errno) << endl;
+        }
+    }
+
+    // The memtable was flushed, nothing logged so far is needed any more
+    void reset()
+    {
+        if (fd >= 0)
+        {
+            truncate_to(0);
+            size = 0;
+        }
+    }
+
+    // Batches in log order up to the first torn or damaged entry, which is
+    // dropped with everything after it
+    vector<string> read_all()
+    {
+        vector<string> batches;
+        if (fd < 0)
+        {
+            return batches;
+        }
+
+        string data;
+        char buf[65536];
+        ssize_t n;
+        off_t pos = 0;
+        while ((n = pread(fd, buf, sizeof(buf), pos)) > 0)
+        {
+            data.append(buf, n);
+            pos += n;
+        }
+
+        size_t off = 0;
+        uint32_t len, crc;
+        while (off + sizeof(len) + sizeof(crc) <= data.size())
+        {
+            memcpy(&len, data.data() + off, sizeof(len));
+            memcpy(&crc, data.data() + off + sizeof(len), sizeof(crc));
+            size_t payload = off + sizeof(len) + sizeof(crc);
+            if (len > data.size() - payload || entry_crc(len, data.data() + payload) != crc)
+            {
+                break;
+            }
+            batches.push_back(data.substr(payload, len));
+            off = payload + len;
+        }
+        if (off < data.size())
+        {
+            cerr << "Write-ahead log: dropping " << data.size() - off << " bytes after the last valid entry" << endl;
+            if (ftruncate(fd, off) < 0)
+            {
+                cerr << "Error dropping torn write-ahead log tail: " << strerror(errno) << endl;
+            }
+        }
+        size = off;
+        return batches;
+    }
+};
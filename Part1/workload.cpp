@@ -0,0 +1,71 @@
+#include <cmath>
+#include <random>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// Ranks 0..n-1 drawn with probability proportional to 1/(rank+1)^theta, with
+// the method YCSB uses (Gray et al., "Quickly generating billion-record
+// synthetic databases"). Rank 0 is the most popular.
+class ZipfianGenerator
+{
+private:
+    uint64_t n;
+    double theta, alpha, zetan, eta;
+
+    static double zeta(uint64_t n, double theta)
+    {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++)
+        {
+            sum += 1 / pow((double)i, theta);
+        }
+        return sum;
+    }
+
+public:
+    ZipfianGenerator(uint64_t n, double theta) : n(n), theta(theta)
+    {
+        alpha = 1 / (1 - theta);
+        zetan = zeta(n, theta);
+        eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / zetan);
+    }
+
+    uint64_t next(mt19937_64 &rng)
+    {
+        double u = uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan;
+        if (uz < 1)
+        {
+            return 0;
+        }
+        if (uz < 1 + pow(0.5, theta))
+        {
+            return 1;
+        }
+        return min<uint64_t>(n - 1, (uint64_t)(n * pow(eta * u - eta + 1, alpha)));
+    }
+};
+
+// Spreads ranks over 0..n-1 so popular keys are not neighbours, as YCSB's
+// scrambled Zipfian does with an FNV hash
+uint64_t scramble(uint64_t rank, uint64_t n)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; i++)
+    {
+        hash ^= (rank >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash % n;
+}
+
+// Benchmark key for a record number: fixed width, so key order is number order
+string workload_key(uint64_t id)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "user%012llu", (unsigned long long)id);
+    return key;
+}